@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,15 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Locking:
+// * Each hash bucket has its own spin-lock, which protects the
+//     bucket's list and the dev, blockno, refcnt and lastuse
+//     fields of every buffer on that list.
+// * A lookup that hits in the cache takes only its bucket's lock.
+// * bcache.lock serializes evictions. Only the evicting process
+//     ever holds more than one bucket lock at a time, so stealing
+//     a free buffer from another bucket cannot deadlock.
 
 
 #include "types.h"
@@ -19,37 +28,130 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
-struct {
+#define NBUCKET 13
+#define BHASH(dev, blockno) ((((dev) << 27) | (blockno)) % NBUCKET)
+#define NAHEAD 16  // most buffers breadahead() hands to the disk at once
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;   // circular list through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;   // held while evicting a buffer
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  uint64 hit, miss;       // bread()s, for iostat()
 } bcache;
 
+static void
+bucket_remove(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+bucket_insert(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  initqlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  // Spread the free buffers over the buckets.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bucket_insert(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
+  }
+}
+
+// Look for block (dev, blockno) in bucket bk.
+// If found, take a reference to it.
+// Caller must hold bk->lock.
+static struct buf*
+bucket_lookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
   }
+  return 0;
+}
+
+// Recycle the least recently used (LRU) unused buffer,
+// from whichever bucket it lives in, to hold block
+// (dev, blockno), and insert it in bk with one reference.
+// Returns 0 if every buffer is in use.
+// Caller must hold bcache.lock and must have checked
+// that the block is not already cached.
+static struct buf*
+brecycle(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b, *victim;
+  struct bucket *vbk, *obk;
+
+  // Keep holding the lock of the bucket that contains the
+  // best candidate so far.
+  victim = 0;
+  vbk = 0;
+  for(obk = bcache.bucket; obk < bcache.bucket+NBUCKET; obk++){
+    int found = 0;
+    acquire(&obk->lock);
+    for(b = obk->head.next; b != &obk->head; b = b->next){
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        found = 1;
+      }
+    }
+    if(found){
+      if(vbk)
+        release(&vbk->lock);
+      vbk = obk;
+    } else {
+      release(&obk->lock);
+    }
+  }
+  if(victim == 0)
+    return 0;
+
+  bucket_remove(victim);
+  release(&vbk->lock);
+
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+
+  acquire(&bk->lock);
+  bucket_insert(bk, victim);
+  release(&bk->lock);
+  return victim;
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,33 +161,38 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = bucket_lookup(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Only one process evicts at a time, so check
+  // again: another eviction may have brought the block in while
+  // we were not holding bk->lock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bucket_lookup(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+
+  if((b = brecycle(bk, dev, blockno)) == 0)
+    panic("bget: no buffers");
+  release(&bcache.lock);
+
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -93,15 +200,29 @@ struct buf*
 bread(uint dev, uint blockno)
 {
   struct buf *b;
+  struct proc *p;
 
   b = bget(dev, blockno);
   if(!b->valid) {
+    __sync_fetch_and_add(&bcache.miss, 1);
+    if((p = myproc()) != 0)
+      p->ru[RU_INBLOCK]++;
     virtio_disk_rw(b, 0);
     b->valid = 1;
+  } else {
+    __sync_fetch_and_add(&bcache.hit, 1);
   }
   return b;
 }
 
+// copy the bread() hit and miss counts to *st.
+void
+bstat(struct iostat *st)
+{
+  st->bhit = bcache.hit;
+  st->bmiss = bcache.miss;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +232,126 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Unlock b and drop a reference to it.
+// Record when it was last used, for LRU eviction in bget().
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  releasesleep(&b->lock);
+
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = ticks;
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
+  bput(b);
+}
 
-  releasesleep(&b->lock);
+// Called by virtio_disk_intr() when a read started by
+// breadahead() has finished. The buffer is still locked
+// on behalf of the process that started the read.
+static void
+breaddone(struct buf *b)
+{
+  b->valid = 1;
+  bput(b);
+}
+
+// Start a buffer for block (dev, blockno) to be read ahead.
+// Returns it locked, or 0 if the block is cached already,
+// is being read, or every buffer is in use.
+static struct buf*
+bgetahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+  struct proc *p;
+
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+
+  // cached, or already being read?
+  acquire(&bk->lock);
+  if((b = bucket_lookup(bk, dev, blockno)) != 0){
+    b->refcnt--;
+    release(&bk->lock);
+    return 0;
+  }
+  release(&bk->lock);
 
   acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  acquire(&bk->lock);
+  if((b = bucket_lookup(bk, dev, blockno)) != 0){
+    b->refcnt--;
+    release(&bk->lock);
+    release(&bcache.lock);
+    return 0;
   }
-  
+  release(&bk->lock);
+  b = brecycle(bk, dev, blockno);
   release(&bcache.lock);
+  if(b == 0)
+    return 0;
+
+  // no one else can hold a buffer that was just recycled.
+  acquiresleep(&b->lock);
+  b->iodone = breaddone;
+  if((p = myproc()) != 0)
+    p->ru[RU_INBLOCK]++;
+  return b;
+}
+
+// Start reading the n blocks in blockno[] into the cache,
+// skipping those that are there already, and return
+// without waiting for the disk. The disk reads runs of
+// consecutive blocks with one request each.
+// A later bread() of a block waits for its read to finish.
+void
+breadahead(uint dev, uint *blockno, int n)
+{
+  struct buf *bs[NAHEAD];
+  int i, m;
+
+  while(n > 0){
+    m = 0;
+    for(i = 0; i < n && i < NAHEAD; i++){
+      if((bs[m] = bgetahead(dev, blockno[i])) != 0)
+        m++;
+    }
+    if(m > 0)
+      virtio_disk_submit(bs, m, 0);
+    blockno += i;
+    n -= i;
+  }
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
-
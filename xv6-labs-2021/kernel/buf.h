@@ -1,11 +1,14 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int queue;   // virtqueue of the disk request, while disk is 1
+  void (*iodone)(struct buf *); // called when the disk is done, if set
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks at last brelse(), for LRU eviction
+  struct buf *prev; // hash bucket list
   struct buf *next;
   uchar data[BSIZE];
 };
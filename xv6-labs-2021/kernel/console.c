@@ -21,23 +21,26 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
 
 //
-// send one character to the uart.
-// called by printf, and to echo input characters,
-// but not from write().
+// send one character to the uart, without waiting for it.
+// called to echo input characters, but not from write().
 //
 void
 consputc(int c)
 {
+  char ch;
+
   if(c == BACKSPACE){
     // if the user typed backspace, overwrite with a space.
-    uartputc_sync('\b'); uartputc_sync(' '); uartputc_sync('\b');
+    uartputs_async("\b \b", 3);
   } else {
-    uartputc_sync(c);
+    ch = c;
+    uartputs_async(&ch, 1);
   }
 }
 
@@ -58,13 +61,18 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[128];
+  int i, m;
+
+  // copy a chunk at a time, outside the uart's lock,
+  // since copying in may fault and sleep.
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    uartputs(buf, m);
   }
 
   return i;
@@ -84,6 +92,8 @@ consoleread(int user_dst, uint64 dst, int n)
   char cbuf;
 
   target = n;
+  if(user_dst)
+    uvmprefault(dst, n, 1);
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
@@ -170,6 +180,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup();
       }
     }
     break;
@@ -178,6 +189,19 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// is a whole line waiting for consoleread()?
+static int
+consolepoll(void)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -189,4 +213,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -0,0 +1,128 @@
+// Directory name cache.
+//
+// Remembers the result of dirlookup() for (directory, name):
+// the inode number and dirent offset of a name that is present,
+// or that the name is absent (a negative entry, inum 0). A warm
+// path lookup then reads no directory blocks.
+//
+// Every change to a directory's entries happens with the
+// directory locked, in dirlink() and sys_unlink(), and each
+// updates the cache; lookups also hold the directory's lock.
+// When a directory inode is freed, iput() drops all entries
+// for it, since its inode number may be reused.
+//
+// The cache is set-associative: a name hashes to one set of
+// NDWAY entries, each set with its own lock, and a miss
+// replaces the least recently used entry of the set.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NDSET 32
+#define NDWAY 4
+
+struct dentry {
+  uint dev;
+  uint dinum;          // directory inode, 0 if the entry is unused
+  char name[DIRSIZ];
+  uint inum;           // 0 if name is not in the directory
+  uint off;            // offset of name's dirent
+  uint lastuse;
+};
+
+static struct {
+  struct spinlock lock;
+  uint clock;          // for lastuse, under lock
+  struct dentry e[NDWAY];
+} dset[NDSET];
+
+void
+dcacheinit(void)
+{
+  for(int i = 0; i < NDSET; i++)
+    initlock(&dset[i].lock, "dcache");
+}
+
+static int
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h = dev * 31 + dinum;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDSET;
+}
+
+// Look up name in directory (dev, dinum). Returns 1 and sets
+// *inum and *off if the cache knows name is present, -1 if it
+// knows name is absent, or 0 if it has no entry.
+int
+dcache_lookup(uint dev, uint dinum, char *name, uint *inum, uint *off)
+{
+  int h = dhash(dev, dinum, name), r = 0;
+  struct dentry *d;
+
+  acquire(&dset[h].lock);
+  for(d = dset[h].e; d < &dset[h].e[NDWAY]; d++){
+    if(d->dinum == dinum && d->dev == dev && namecmp(d->name, name) == 0){
+      d->lastuse = ++dset[h].clock;
+      if(d->inum){
+        *inum = d->inum;
+        *off = d->off;
+        r = 1;
+      } else {
+        r = -1;
+      }
+      break;
+    }
+  }
+  release(&dset[h].lock);
+  return r;
+}
+
+// Record that name in directory (dev, dinum) is inode inum with
+// its dirent at off, or that it is absent if inum is 0.
+void
+dcache_enter(uint dev, uint dinum, char *name, uint inum, uint off)
+{
+  int h = dhash(dev, dinum, name);
+  struct dentry *d, *victim;
+
+  acquire(&dset[h].lock);
+  victim = 0;
+  for(d = dset[h].e; d < &dset[h].e[NDWAY]; d++){
+    if(d->dinum == dinum && d->dev == dev && namecmp(d->name, name) == 0){
+      victim = d;
+      break;
+    }
+    if(victim == 0 || d->lastuse < victim->lastuse)
+      victim = d;
+  }
+  victim->dev = dev;
+  victim->dinum = dinum;
+  strncpy(victim->name, name, DIRSIZ);
+  victim->inum = inum;
+  victim->off = off;
+  victim->lastuse = ++dset[h].clock;
+  release(&dset[h].lock);
+}
+
+// Forget all names in directory (dev, dinum).
+void
+dcache_purge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  for(int h = 0; h < NDSET; h++){
+    acquire(&dset[h].lock);
+    for(d = dset[h].e; d < &dset[h].e[NDWAY]; d++)
+      if(d->dinum == dinum && d->dev == dev)
+        d->dinum = 0;
+    release(&dset[h].lock);
+  }
+}
@@ -1,7 +1,10 @@
 struct buf;
+struct kcache;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct iostat;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -16,14 +19,26 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint*, int);
+void            bstat(struct iostat*);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(uint, uint, char*, uint*, uint*);
+void            dcache_enter(uint, uint, char*, uint, uint);
+void            dcache_purge(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
+int             execpage(struct proc*, uint64);
+int             execfault(struct proc*, uint64);
+void            execfork(struct proc*, struct proc*);
+void            execexit(struct proc*);
 
 // file.c
 struct file*    filealloc(void);
@@ -33,10 +48,16 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filecopy(struct file*, struct file*, int);
+int             filepoll(struct file*, int);
 
 // fs.c
+void            bfreeclose(void);
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -50,9 +71,12 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readiblk(struct inode*, int, uint64, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            iextent(struct inode*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,18 +87,50 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kdup(void *);
+void*           kalloc_zeroed(void);
+int             kallocn(void **, int);
+int             kallocn_zeroed(void **, int);
+void            kfreen(void **, int);
+int             kzeroidle(void);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int, int);
+void            end_opn(int, int);
+void            log_data(struct buf*);
+void            log_sync(void);
+
+// mmap.c
+uint64          mmap(struct file*, uint64, int, int, uint);
+int             munmap(uint64, uint64);
+int             mmapfault(struct proc*, uint64, int);
+int             mmapwritable(struct proc*, uint64);
+int             mmapshared(struct proc*, uint64);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapexit(struct proc*);
+uint64          mmapbase(struct proc*);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+int             pcache_cached(struct inode*, uint);
+int             pcache_read(struct inode*, int, uint64, uint, uint);
+void            pcache_write(struct inode*, uint, char*, uint);
+void            pcache_purge(struct inode*);
+int             pcache_reclaim(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipepoll(struct pipe*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,7 +141,8 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+void            kthread(void (*)(void), char*);
+uint64          growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -98,13 +155,23 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
-int             wait(uint64);
+int             wait(int, uint64, uint64, int);
+int             clone(uint64, uint64, uint64);
+int             spawn(char*, char**, int*, int);
+int             getrusage(int, uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
+void            preempt(void);
+int             setprio(int, int);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -112,10 +179,23 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initqlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
+int             lockstat(uint64, int);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+void            kcache_init(struct kcache*, char*, uint);
+void*           kcache_alloc(struct kcache*);
+void            kcache_free(struct kcache*, void*);
+int             kcache_reclaim(void);
+void            kcache_cpudrain(void);
+void            kmallocinit(void);
+void*           kmalloc(uint);
+void            kmfree(void*, uint);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -131,6 +211,20 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// sysfile.c
+void            argfdput(struct proc*);
+
+// poll.c
+void            pollinit(void);
+void            pollwakeup(void);
+void            polltick(void);
+int             poll(uint64, int, int);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -145,12 +239,23 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            tickupdate(void);
+void            tickwait(uint);
+void            timerarm(void);
+void            ipi(int);
+
+// trace.c
+void            traceinit(void);
+void            trace(int, uint64);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 void            uartputc_sync(int);
+void            uartputs(char*, int);
+void            uartputs_async(char*, int);
+void            uartflush_sync(void);
 int             uartgetc(void);
 
 // vm.c
@@ -163,9 +268,17 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+int             vmfault(pagetable_t, uint64, uint64, int);
+void            uvmprefault(uint64, uint64, int);
+extern int      asidok;
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t *         walk(pagetable_t, uint64, int);
+int             uvminstall(pagetable_t, uint64, void*, int);
+uint64          uvmpa(pagetable_t, uint64);
+void            tlbshootdown(pagetable_t);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -180,7 +293,11 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+void            virtio_disk_rwv(struct buf **, int, int);
+void            virtio_disk_submit(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_stat(struct iostat*);
+void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,20 +6,39 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+// exec() reads no program segment: it only records where each
+// one is in the file, and execfault() reads a page in when the
+// program first touches it. Memory past a segment's file bytes
+// is zero-filled, like other lazily allocated memory below p->mm->sz.
+//
+// The program is not snapshotted: a page that a running process
+// has not touched yet is read from the file as it is then, so a
+// process sees a rewrite of its own executable in those pages.
+// The process may even write() its executable from such a page;
+// writei() faults the page in before it reads the block.
 
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct seg seg[NEXECSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct inode *exe = 0, *oldexe;
+
+  // the other threads would be left running in a freed
+  // address space.
+  if(p->mm->ref > 1)
+    return -1;
 
   begin_op();
 
@@ -38,7 +57,9 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments.
+  memset(seg, 0, sizeof(seg));
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,21 +69,30 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz > MMAPTOP - 2*PGSIZE)
       goto bad;
-    sz = sz1;
     if((ph.vaddr % PGSIZE) != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
+    if(ph.filesz > 0){
+      if(nseg == NEXECSEG)
+        goto bad;
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].off = ph.off;
+      nseg++;
+    }
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  iunlock(ip);
   end_op();
+  exe = ip;   // keep the reference, for execfault()
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = p->mm->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -109,12 +139,28 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  mmapexit(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
-  p->sz = sz;
+  p->mm->tlbstale = ~0L;  // TLBs hold the old page table's entries
+  p->mm->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  oldexe = p->mm->exe;
+  p->mm->exe = exe;
+  memmove(p->mm->seg, seg, sizeof(seg));
+  if(p->tfva != TRAPFRAME){
+    // a thread whose siblings have all gone; proc_pagetable()
+    // mapped its trapframe in the usual place.
+    uvmunmap(oldpagetable, p->tfva, 1, 0);
+    p->tfva = TRAPFRAME;
+  }
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -125,30 +171,103 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Does the page at va of p's program hold bytes of the
+// executable file?
+int
+execpage(struct proc *p, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
+  struct seg *s;
+
+  if(p->mm->exe == 0)
+    return 0;
+  va = PGROUNDDOWN(va);
+  for(s = p->mm->seg; s < &p->mm->seg[NEXECSEG]; s++)
+    if(s->filesz && va < s->va + s->filesz && va + PGSIZE > s->va)
+      return 1;
   return 0;
 }
+
+// Read in the page of p's program containing va, if any of it
+// comes from the executable file. A page that lies wholly in
+// one segment's file bytes comes from the page cache, shared
+// copy-on-write with other processes running the program; a
+// page that is partly zero-filled is the process's own.
+// Returns 1 if the page is now mapped, 0 if no segment has file
+// bytes in it, so that it is plain zero-filled memory, or -1 if
+// memory is exhausted or the read would have to sleep under a
+// spinlock.
+int
+execfault(struct proc *p, uint64 va)
+{
+  struct seg *s;
+  struct inode *ip = p->mm->exe;
+  uint64 a, end;
+  char *mem;
+  int locked, perm;
+
+  va = PGROUNDDOWN(va);
+  if(!execpage(p, va))
+    return 0;
+  // as in mmapfault().
+  if(mycpu()->noff > 0)
+    return -1;
+
+  for(s = p->mm->seg; s < &p->mm->seg[NEXECSEG]; s++)
+    if(s->filesz && va >= s->va && va + PGSIZE <= s->va + s->filesz)
+      break;
+
+  if((locked = holdingsleep(&ip->lock)) == 0)
+    ilock(ip);
+  if(s < &p->mm->seg[NEXECSEG]){
+    // the following pages are likely to be wanted soon.
+    ireadahead(ip, s->off + (va - s->va), s->filesz - (va - s->va));
+    mem = pcache_get(ip, s->off + (va - s->va));
+    perm = PTE_R|PTE_X|PTE_U|PTE_COW;
+  } else if((mem = kalloc_zeroed()) != 0){
+    for(s = p->mm->seg; s < &p->mm->seg[NEXECSEG]; s++){
+      if(s->filesz == 0 || va >= s->va + s->filesz || va + PGSIZE <= s->va)
+        continue;
+      a = va < s->va ? s->va : va;
+      end = va + PGSIZE < s->va + s->filesz ? va + PGSIZE : s->va + s->filesz;
+      ireadahead(ip, s->off + (a - s->va), s->filesz - (a - s->va));
+      readi(ip, 0, (uint64)mem + (a - va), s->off + (a - s->va), end - a);
+    }
+    perm = PTE_W|PTE_X|PTE_R|PTE_U;
+  }
+  if(!locked)
+    iunlock(ip);
+  if(mem == 0)
+    return -1;
+
+  if(uvminstall(p->pagetable, va, mem, perm) != 0)
+    return -1;
+  return 1;
+}
+
+// Give child np p's executable, for the pages that neither
+// has touched yet.
+void
+execfork(struct proc *p, struct proc *np)
+{
+  np->mm->exe = p->mm->exe ? idup(p->mm->exe) : 0;
+  memmove(np->mm->seg, p->mm->seg, sizeof(p->mm->seg));
+}
+
+// Drop p's executable, as on exit(). Caller must be in a
+// transaction.
+void
+execexit(struct proc *p)
+{
+  if(p->mm->exe){
+    iput(p->mm->exe);
+    p->mm->exe = 0;
+  }
+}
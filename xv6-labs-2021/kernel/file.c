@@ -8,21 +8,27 @@
 #include "param.h"
 #include "fs.h"
 #include "spinlock.h"
+#include "slab.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
+// open files come from a kcache, so there is no limit on
+// their number but memory. ftable.lock protects f->ref.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kcache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kcache_init(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +37,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kcache_alloc(&ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +70,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kcache_free(&ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -119,8 +119,21 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    // if reads are sequential, start reading this one and the
+    // blocks after it, so the disk overlaps with the copyout.
+    // the window doubles with each sequential read.
+    if(f->off == f->ranext){
+      if(f->rawin == 0)
+        f->rawin = RAMIN;
+      else if(f->rawin < RAMAX)
+        f->rawin *= 2;
+      ireadahead(f->ip, f->off, n + f->rawin * BSIZE);
+    } else {
+      f->rawin = 0;
+    }
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    f->ranext = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,54 +142,259 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Which of events (POLLIN, POLLOUT) are ready on f, plus POLLHUP
+// or POLLERR. Regular files are always ready.
+int
+filepoll(struct file *f, int events)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, f->writable);
+  else if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV && devsw[f->major].poll)
+    r = devsw[f->major].poll();
+  else
+    r = POLLIN | POLLOUT;
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & (events | POLLHUP | POLLERR);
+}
+
+// Read from inode file f into the niov buffers of iov, starting
+// at *poff and advancing it, all under one ilock(). Stops at the
+// first short read. Returns the number of bytes read, or -1.
+static int
+inoderead(struct file *f, struct iovec *iov, int niov, uint *poff)
+{
+  int i, r = 0, tot = 0;
+
+  ilock(f->ip);
+  for(i = 0; i < niov; i++){
+    r = readi(f->ip, 1, (uint64)iov[i].iov_base, *poff, iov[i].iov_len);
+    if(r > 0){
+      *poff += r;
+      tot += r;
+    }
+    if(r != iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  return (r < 0 && tot == 0) ? -1 : tot;
+}
+
+// Blocks that writing n bytes at off may dirty: *nd data blocks,
+// and, returned, the logged blocks: the indirect blocks above
+// the data, bitmap blocks for allocating all of those, and the
+// i-node.
+static int
+writeblocks(uint off, int n, int *nd)
+{
+  int ni;
+
+  *nd = (off + n + BSIZE - 1) / BSIZE - off / BSIZE;
+  ni = 2 + *nd / NINDIRECT + 1;
+  return ni + (*nd + ni) / BPB + 2 + 1;
+}
+
+// Write the niov buffers of iov, user or kernel addresses as
+// user_src says, to inode file f at *poff, advancing it.
+// Buffers are packed into as few transactions as fit, each
+// reserving the blocks its bytes need, up to WRITEOPBLOCKS of
+// each kind. Only regular files have ordered data blocks.
+// Returns the number of bytes written, or -1 if any write
+// failed.
+static int
+inodewrite(struct file *f, int user_src, struct iovec *iov, int niov, uint *poff)
+{
+  int max, i, done, tot, room, m, r, n, nblocks, ndata;
+
+  n = 0;
+  for(i = 0; i < niov; i++)
+    n += iov[i].iov_len;
+
+  // largest write that fits, however it is aligned.
+  for(max = WRITEOPBLOCKS * BSIZE; max > BSIZE; max -= BSIZE)
+    if(writeblocks(BSIZE - 1, max, &ndata) <= WRITEOPBLOCKS &&
+       ndata <= WRITEOPBLOCKS)
+      break;
+
+  i = done = tot = 0;
+  r = m = 0;
+  while(i < niov){
+    room = n - tot < max ? n - tot : max;
+    nblocks = writeblocks(*poff, room, &ndata);
+    if(f->ip->type != T_FILE){
+      nblocks += ndata;
+      ndata = 0;
+    }
+    begin_opn(nblocks, ndata);
+    ilock(f->ip);
+    while(i < niov){
+      m = iov[i].iov_len - done;
+      if(m > room)
+        m = room;
+      r = writei(f->ip, user_src, (uint64)iov[i].iov_base + done, *poff, m);
+      if(r > 0){
+        *poff += r;
+        tot += r;
+        done += r;
+        room -= r;
+      }
+      if(r != m)
+        break;
+      if(done < iov[i].iov_len)
+        break;   // no room left in this transaction
+      i++;
+      done = 0;
+    }
+    iunlock(f->ip);
+    end_opn(nblocks, ndata);
+
+    if(r != m){
+      // error from writei
+      break;
+    }
+  }
+  return (tot == n ? n : -1);
+}
+
+static int writev1(struct file*, int, struct iovec*, int, int);
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Read into the niov user buffers of iov from file f, at offset
+// off, or at f->off if off is -1. Only inodes have offsets.
+int
+filereadv(struct file *f, struct iovec *iov, int niov, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE){
+    if(off < 0)
+      return inoderead(f, iov, niov, &f->off);
+    o = off;
+    return inoderead(f, iov, niov, &o);
+  }
+  if(off >= 0)
+    return -1;
+
+  tot = 0;
+  for(i = 0; i < niov; i++){
+    if((r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Write the niov user buffers of iov to file f, at offset off,
+// or at f->off if off is -1. Only inodes have offsets.
+int
+filewritev(struct file *f, struct iovec *iov, int niov, int off)
+{
+  return writev1(f, 1, iov, niov, off);
+}
+
+// filewritev() of user or kernel buffers, as user_src says.
+static int
+writev1(struct file *f, int user_src, struct iovec *iov, int niov, int off)
+{
+  int i, r, tot;
+  uint o;
 
   if(f->writable == 0)
     return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+  if(f->type == FD_INODE){
+    if(off < 0)
+      return inodewrite(f, user_src, iov, niov, &f->off);
+    o = off;
+    return inodewrite(f, user_src, iov, niov, &o);
   }
+  if(off >= 0)
+    return -1;
 
-  return ret;
+  tot = 0;
+  for(i = 0; i < niov; i++){
+    if(f->type == FD_PIPE){
+      r = pipewrite(f->pipe, user_src, (uint64)iov[i].iov_base, iov[i].iov_len);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+        return -1;
+      r = devsw[f->major].write(user_src, (uint64)iov[i].iov_base, iov[i].iov_len);
+    } else {
+      panic("filewrite");
+    }
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  return tot;
 }
 
+// Copy up to n bytes from inode file in, at in->off, to file out,
+// a page at a time through a kernel buffer rather than through
+// user memory. Returns the number of bytes copied, which is less
+// than n at the end of in, or -1.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  struct iovec iov;
+  char *buf;
+  int tot, m, r, w;
+
+  if(in->readable == 0 || out->writable == 0 || in->type != FD_INODE)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  for(tot = 0; tot < n; tot += w){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    ilock(in->ip);
+    if((r = readi(in->ip, 0, (uint64)buf, in->off, m)) > 0)
+      in->off += r;
+    iunlock(in->ip);
+    if(r <= 0){
+      if(r < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+
+    iov.iov_base = buf;
+    iov.iov_len = r;
+    if((w = writev1(out, 0, &iov, 1, -1)) != r){
+      if(w > 0)
+        tot += w;
+      else if(tot == 0)
+        tot = -1;
+      break;
+    }
+    if(r < m){
+      tot += w;
+      break;
+    }
+  }
+  kfree(buf);
+  return tot;
+}
@@ -6,9 +6,14 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint ranext;       // FD_INODE: offset a sequential read would start at
+  uint rawin;        // FD_INODE: readahead window, in blocks
   short major;       // FD_DEVICE
 };
 
+#define RAMIN  4   // initial readahead window, in blocks
+#define RAMAX  16  // largest readahead window
+
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
@@ -18,6 +23,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain, see iget()
+  uint lastuse;       // ticks at last iput(), for LRU recycling
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,15 +33,24 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint extidx;        // extent-mapped files: last extent bmap() used,
+  uint extbase;       // and the first file block it maps
+  struct dirindex *dix; // large directories: name index, see dirlookup()
+  struct cpage *pages; // cached pages, see pcache.c
+  int pcodd;          // some of them at unaligned offsets
 };
 
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(void);   // POLLIN/POLLOUT if ready; 0 means always ready
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define PROF    2
+#define TRACE   3
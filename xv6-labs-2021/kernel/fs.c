@@ -15,6 +15,7 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "slab.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -26,6 +27,10 @@
 // only one device
 struct superblock sb; 
 
+static void bcount(int);
+static void dixinit(void);
+static void dixfree(struct inode*);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,47 +49,192 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bcount(dev);
 }
 
-// Zero a block.
+// Zero a block, which holds file data if data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// The free map is scanned a 64-bit word at a time, so fully
+// allocated stretches are skipped quickly, starting at a hint
+// just past the last block allocated instead of at block 0.
+// nfree counts free blocks, so an exhausted disk is noticed
+// without scanning the whole map.
+//
+// File data is written to its home block ahead of the commit of
+// the transaction that allocates it (see log_data()), so a block
+// freed in the open transaction must not be allocated again until
+// that transaction closes: a crash before the commit would leave
+// the block's old owner pointing at the new data. Such blocks are
+// marked in pend[], under the lock of their bitmap block, and are
+// counted in npend rather than nfree.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+#define BPW 64  // bitmap bits per uint64 word
+
+// like sb, there should be one of these per disk device.
+struct {
+  struct spinlock lock;
+  uint next;   // allocation hint: search the free map from here
+  uint nfree;  // number of free blocks
+  uint npend;  // blocks freed in the open transaction
+  uint64 pend[FSSIZE / BPW + 1];
+} bmap_state;
+
+#define PENDING(b) (bmap_state.pend[(b) / BPW] & (1ULL << ((b) % BPW)))
+
+// Return the index of the lowest zero bit in w, which must not be ~0.
+static int
+firstzero(uint64 w)
+{
+  int i;
+
+  w = ~w & (w + 1);   // isolate lowest zero bit of the original w
+  for(i = 0; (w & 0xff) == 0; i += 8)
+    w >>= 8;
+  while((w & 1) == 0){
+    w >>= 1;
+    i++;
+  }
+  return i;
+}
+
+// Return the number of zero bits in w.
+static int
+countzero(uint64 w)
+{
+  int n;
+
+  w = ~w;
+  for(n = 0; w; n++)
+    w &= w - 1;
+  return n;
+}
+
+// Count the free blocks in the free map. Called once at boot.
+static void
+bcount(int dev)
 {
-  int b, bi, m;
+  uint b, nfree, end;
+  int wi, bi;
+  uint64 *w;
   struct buf *bp;
 
-  bp = 0;
+  if(sb.size > FSSIZE)
+    panic("bcount: file system too large");
+  nfree = 0;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    w = (uint64*)bp->data;
+    end = sb.size - b < BPB ? sb.size - b : BPB;
+    for(wi = 0; wi < end / BPW; wi++)
+      nfree += countzero(w[wi]);
+    for(bi = wi * BPW; bi < end; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        nfree++;
+    brelse(bp);
+  }
+
+  initlock(&bmap_state.lock, "bmap");
+  bmap_state.next = 0;
+  bmap_state.nfree = nfree;
+}
+
+// Allocate a zeroed disk block, for file data if data is set.
+static uint
+balloc(uint dev, int data)
+{
+  uint b, start, nbmap, m, i;
+  int wi;
+  uint64 *w;
+  struct buf *bp;
+
+  acquire(&bmap_state.lock);
+  if(bmap_state.nfree == 0)
+    panic("balloc: out of blocks");
+  start = bmap_state.next;
+  release(&bmap_state.lock);
+  if(start >= sb.size)
+    start = 0;
+
+  // Visit every bitmap block once, starting with the one holding
+  // the hint, then that one again from its beginning, in case
+  // there are free blocks before the hint.
+  nbmap = (sb.size + BPB - 1) / BPB;
+  for(i = 0; i <= nbmap; i++){
+    b = ((start / BPB + i) % nbmap) * BPB;
+    bp = bread(dev, BBLOCK(b, sb));
+    w = (uint64*)bp->data;
+    for(wi = (i == 0 ? (start % BPB) / BPW : 0); wi < BPB / BPW; wi++){
+      uint64 used = w[wi] | bmap_state.pend[(b - b % BPB) / BPW + wi];
+      if(used == ~0ULL)
+        continue;   // 64 blocks in use
+      b = b - b % BPB + wi * BPW + firstzero(used);
+      if(b >= sb.size)
+        break;
+      m = b % BPW;
+      w[wi] |= 1ULL << m;   // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+
+      acquire(&bmap_state.lock);
+      bmap_state.next = b + 1;
+      bmap_state.nfree--;
+      release(&bmap_state.lock);
+
+      bzero(dev, b, data);
+      return b;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate block b in particular, if it is free, for file
+// data if data is set.
+// Returns 1 if b is now allocated and zeroed, 0 if not.
+static int
+ballocat(uint dev, uint b, int data)
+{
+  int bi, m;
+  struct buf *bp;
+
+  if(b < sb.bmapstart + sb.size/BPB + 1 || b >= sb.size)
+    return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if((bp->data[bi/8] & m) || PENDING(b)){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= m;
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&bmap_state.lock);
+  if(bmap_state.next == b)
+    bmap_state.next = b + 1;
+  bmap_state.nfree--;
+  release(&bmap_state.lock);
+
+  bzero(dev, b, data);
+  return 1;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -99,7 +249,27 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  bmap_state.pend[b / BPW] |= 1ULL << (b % BPW);
   brelse(bp);
+
+  acquire(&bmap_state.lock);
+  bmap_state.npend++;
+  release(&bmap_state.lock);
+}
+
+// Called by the log with the open transaction closing and no
+// operations outstanding: the blocks freed in it may be
+// allocated again.
+void
+bfreeclose(void)
+{
+  acquire(&bmap_state.lock);
+  if(bmap_state.npend > 0){
+    memset(bmap_state.pend, 0, sizeof(bmap_state.pend));
+    bmap_state.nfree += bmap_state.npend;
+    bmap_state.npend = 0;
+  }
+  release(&bmap_state.lock);
 }
 
 // Inodes.
@@ -132,13 +302,19 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. The table is a hash, and its entries come
+//   from a kcache, so it has no fixed size. A free entry keeps
+//   its inode, valid, until iget() needs the entry for another:
+//   it then takes the least recently used free entry, once the
+//   table holds NINODE entries. A table that has grown past
+//   NINODE shrinks back as iput() frees entries.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk. An iget()
+//   of a recently used inode thus needs no disk read.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -162,29 +338,44 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// Each hash bucket has a spin-lock, which protects its chain
+// and the ip->ref, ip->dev, ip->inum and ip->lastuse fields
+// of the entries on it. Since ip->ref indicates whether an
+// entry is free, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold the bucket lock while
+// using any of those fields. A hit in iget() takes only its
+// bucket's lock. itable.lock serializes the allocation and
+// recycling of entries, as bcache.lock does for buffers.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-struct {
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
+struct ibucket {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;   // chain through ip->hnext
+};
+
+struct {
+  struct spinlock lock;   // held while making or recycling an entry
+  struct kcache cache;
+  int n;                  // entries allocated from cache
+  struct ibucket bucket[NIHASH];
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  kcache_init(&itable.cache, "inode", sizeof(struct inode));
+  for(int i = 0; i < NIHASH; i++)
+    initlock(&itable.bucket[i].lock, "itable.bucket");
+  dixinit();
+  dcacheinit();
+  pcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -236,37 +427,132 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Look for inode (dev, inum) in bucket bk.
+// If found, take a reference to it.
+// Caller must hold bk->lock.
+static struct inode*
+ibucket_lookup(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      ip->ref++;
+      return ip;
+    }
+  }
+  return 0;
+}
+
+// Take the least recently used free entry out of its bucket,
+// or return 0 if every entry is in use. Like brecycle(), keeps
+// holding the lock of the bucket with the best candidate so far.
+// Caller must hold itable.lock.
+static struct inode*
+irecycle(void)
+{
+  struct inode *ip, *victim, **pp;
+  struct ibucket *bk, *vbk;
+
+  victim = 0;
+  vbk = 0;
+  for(bk = itable.bucket; bk < itable.bucket+NIHASH; bk++){
+    int found = 0;
+    acquire(&bk->lock);
+    for(ip = bk->head; ip; ip = ip->hnext){
+      if(ip->ref == 0 && (victim == 0 || ip->lastuse < victim->lastuse)){
+        victim = ip;
+        found = 1;
+      }
+    }
+    if(found){
+      if(vbk)
+        release(&vbk->lock);
+      vbk = bk;
+    } else {
+      release(&bk->lock);
+    }
+  }
+  if(victim == 0)
+    return 0;
+
+  for(pp = &vbk->head; *pp != victim; pp = &(*pp)->hnext)
+    ;
+  *pp = victim->hnext;
+  release(&vbk->lock);
+  dixfree(victim);
+  if(victim->pages)
+    pcache_purge(victim);
+  return victim;
+}
+
+// Give free entries beyond the first NINODE back to
+// itable.cache, least recently used first.
+static void
+itrim(void)
+{
+  struct inode *ip;
+
+  acquire(&itable.lock);
+  while(itable.n > NINODE && (ip = irecycle()) != 0){
+    kcache_free(&itable.cache, ip);
+    itable.n--;
+  }
+  release(&itable.lock);
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *bk;
 
-  acquire(&itable.lock);
+  bk = &itable.bucket[IHASH(dev, inum)];
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  acquire(&bk->lock);
+  if((ip = ibucket_lookup(bk, dev, inum)) != 0){
+    release(&bk->lock);
+    return ip;
   }
+  release(&bk->lock);
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Not cached. Check again under itable.lock, which another
+  // iget() of the same inode may have held meanwhile.
+  acquire(&itable.lock);
+  acquire(&bk->lock);
+  if((ip = ibucket_lookup(bk, dev, inum)) != 0){
+    release(&bk->lock);
+    release(&itable.lock);
+    return ip;
+  }
+  release(&bk->lock);
+
+  // Recycle a free entry once the table is full, or make one.
+  ip = 0;
+  if(itable.n >= NINODE)
+    ip = irecycle();
+  if(ip == 0){
+    if((ip = kcache_alloc(&itable.cache)) == 0)
+      panic("iget: no inodes");
+    initsleeplock(&ip->lock, "inode");
+    ip->dix = 0;
+    ip->pages = 0;
+    ip->pcodd = 0;
+    itable.n++;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+
+  acquire(&bk->lock);
+  ip->hnext = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
   release(&itable.lock);
 
   return ip;
@@ -277,9 +563,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = &itable.bucket[IHASH(ip->dev, ip->inum)];
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -306,6 +594,8 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->extidx = 0;
+    ip->extbase = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -324,7 +614,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled, though it stays valid until it is.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -332,7 +622,10 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = &itable.bucket[IHASH(ip->dev, ip->inum)];
+  int trim = 0;
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -341,8 +634,12 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR){
+      dcache_purge(ip->dev, ip->inum);
+      dixfree(ip);
+    }
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -350,11 +647,19 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(--ip->ref == 0){
+    ip->lastuse = ticks;
+    // itable.n is read without itable.lock; itrim() rechecks.
+    trim = itable.n > NINODE;
+  }
+  release(&bk->lock);
+
+  // itable.lock comes before bucket locks.
+  if(trim)
+    itrim();
 }
 
 // Common idiom: unlock, then put.
@@ -370,19 +675,132 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are reached through the doubly-indirect block
+// ip->addrs[NDIRECT+1], which lists NINDIRECT indirect blocks.
+
+// Return entry i of indirect block addr, allocating a
+// block for it if the entry is empty, for file data if
+// data is set.
+static uint
+bmapind(struct inode *ip, uint addr, uint i, int data)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = balloc(ip->dev, data);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in the
+// extent-mapped inode ip, allocating it if bn is the block
+// just past the end of the file's last extent, or returning
+// 0 if that needs an extent and ip has no room for another.
+// Writes only ever append, so the extents cover a prefix of
+// the file.
+// Starts the search at the extent of the previous lookup,
+// so sequential access does not rescan earlier extents.
+static uint
+bmapext(struct inode *ip, uint bn)
+{
+  struct extent *ie = (struct extent*)&ip->addrs[1];
+  struct extent *e = 0;
+  struct buf *bp = 0;
+  uint n, k, base, addr;
+
+  n = ip->addrs[EXTCNT];
+  k = 0;
+  base = 0;
+  if(ip->extidx < n && bn >= ip->extbase){
+    k = ip->extidx;
+    base = ip->extbase;
+  }
+  for(; k < n; k++){
+    if(k < NIEXTENT)
+      e = &ie[k];
+    else {
+      if(bp == 0)
+        bp = bread(ip->dev, ip->addrs[EXTBLK]);
+      e = (struct extent*)bp->data + (k - NIEXTENT);
+    }
+    if(bn < base + e->len){
+      ip->extidx = k;
+      ip->extbase = base;
+      addr = e->start + (bn - base);
+      if(bp)
+        brelse(bp);
+      return addr;
+    }
+    base += e->len;
+  }
+
+  if(bn != base)
+    panic("bmapext: hole");
+
+  // Grow the last extent if the next disk block is free.
+  if(n > 0 && ballocat(ip->dev, e->start + e->len, 1)){
+    e->len++;
+    if(bp){
+      log_write(bp);
+      brelse(bp);
+    }
+    ip->extidx = n - 1;
+    ip->extbase = base - (e->len - 1);
+    return e->start + e->len - 1;
+  }
+
+  // Start a new extent.
+  if(n >= NEXTENT){
+    if(bp)
+      brelse(bp);
+    return 0;
+  }
+  addr = balloc(ip->dev, 1);
+  if(n < NIEXTENT)
+    e = &ie[n];
+  else {
+    if(bp == 0){
+      if(ip->addrs[EXTBLK] == 0)
+        ip->addrs[EXTBLK] = balloc(ip->dev, 0);
+      bp = bread(ip->dev, ip->addrs[EXTBLK]);
+    }
+    e = (struct extent*)bp->data + (n - NIEXTENT);
+  }
+  e->start = addr;
+  e->len = 1;
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
+  ip->addrs[EXTCNT] = n + 1;
+  ip->extidx = n;
+  ip->extbase = base;
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, or returns 0
+// if an extent-mapped inode has no room for it. The blocks
+// of regular files hold ordered data, see log_data();
+// directories and symlinks are logged like other metadata.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
+  int data = ip->type == T_FILE;
+
+  if(ip->addrs[0] == EXTMAGIC)
+    return bmapext(ip, bn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, data);
     return addr;
   }
   bn -= NDIRECT;
@@ -390,28 +808,115 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, 0);
+    return bmapind(ip, addr, bn, data);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load doubly-indirect block, then the indirect
+    // block it points to, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev, 0);
+    addr = bmapind(ip, addr, bn / NINDIRECT, 0);
+    return bmapind(ip, addr, bn % NINDIRECT, data);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists.
+// If depth > 1, the listed blocks are themselves indirect
+// blocks, one level shallower.
+static void
+itruncind(struct inode *ip, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      itruncind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
+// Discard the contents of extent-mapped inode ip.
+// The inode stays extent-mapped.
+static void
+itruncext(struct inode *ip)
+{
+  struct extent *ie = (struct extent*)&ip->addrs[1];
+  struct extent *e;
+  struct buf *bp = 0;
+  uint n, k, j;
+
+  n = ip->addrs[EXTCNT];
+  for(k = 0; k < n; k++){
+    if(k < NIEXTENT)
+      e = &ie[k];
+    else {
+      if(bp == 0)
+        bp = bread(ip->dev, ip->addrs[EXTBLK]);
+      e = (struct extent*)bp->data + (k - NIEXTENT);
+    }
+    for(j = 0; j < e->len; j++)
+      bfree(ip->dev, e->start + j);
+  }
+  if(bp)
+    brelse(bp);
+  if(ip->addrs[EXTBLK])
+    bfree(ip->dev, ip->addrs[EXTBLK]);
+
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->addrs[0] = EXTMAGIC;
+  ip->extidx = 0;
+  ip->extbase = 0;
+}
+
+// Switch ip to the extent format, if it is an empty
+// regular file. Does nothing if ip already has blocks.
+// Caller must hold ip->lock.
+void
+iextent(struct inode *ip)
+{
+  int i;
+
+  if(ip->type != T_FILE || ip->addrs[0] == EXTMAGIC)
+    return;
+  for(i = 0; i < NELEM(ip->addrs); i++)
+    if(ip->addrs[i])
+      return;
+  ip->addrs[0] = EXTMAGIC;
+  ip->extidx = 0;
+  ip->extbase = 0;
+  iupdate(ip);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(ip->pages)
+    pcache_purge(ip);
+
+  if(ip->addrs[0] == EXTMAGIC){
+    itruncext(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -421,17 +926,15 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    itruncind(ip, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    itruncind(ip, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
   ip->size = 0;
   iupdate(ip);
 }
@@ -452,8 +955,23 @@ stati(struct inode *ip, struct stat *st)
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Regular files are read through the page cache, and the
+// rest, which is metadata, through the buffer cache.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  if(ip->type == T_FILE)
+    return pcache_read(ip, user_dst, dst, off, n);
+  return readiblk(ip, user_dst, dst, off, n);
+}
+
+// Read data from inode through the buffer cache, as readi() does.
+int
+readiblk(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
@@ -463,6 +981,10 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // as in writei().
+  if(user_dst)
+    uvmprefault(dst, n, 1);
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -476,6 +998,32 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading the blocks holding len bytes at offset off
+// into the buffer cache, without waiting for them.
+// At most RAMAX blocks are read ahead.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint len)
+{
+  uint bn, end, addrs[RAMAX];
+  int n;
+
+  if(off >= ip->size)
+    return;
+  if(len > ip->size - off)
+    len = ip->size - off;
+  end = (off + len + BSIZE - 1) / BSIZE;
+  if(end - off/BSIZE > RAMAX)
+    end = off/BSIZE + RAMAX;
+  n = 0;
+  for(bn = off/BSIZE; bn < end; bn++){
+    if(ip->pages && pcache_cached(ip, bn * BSIZE))
+      continue;   // no need for the block
+    addrs[n++] = bmap(ip, bn);
+  }
+  breadahead(ip->dev, addrs, n);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -486,7 +1034,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -494,14 +1042,28 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // src may be an unread page mapped from this very file, or of
+  // this very program (see exec.c), whose fault would bread() the
+  // block held below. fault it in first.
+  if(user_src)
+    uvmprefault(src, n, 0);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;   // out of extents
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ip->type == T_FILE){
+      log_data(bp);
+      if(ip->pages)
+        pcache_write(ip, off, (char*)bp->data + (off % BSIZE), m);
+    } else {
+      log_write(bp);
+    }
     brelse(bp);
   }
 
@@ -524,17 +1086,183 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// A directory with at least DIXMIN entries gets an in-memory
+// index, built on first lookup and kept while its inode stays
+// in the table and it keeps DIXMIN entries: a hash from name
+// to dirent offset, and a list of the offsets of empty dirents.
+// Lookups and inserts then cost O(1) rather than a scan of the
+// whole directory. The index is only a cache of the ordinary
+// dirents, so the disk format does not change. If memory runs
+// out the index is dropped, and the directory is scanned as
+// before. The directory's ip->lock protects its index.
+
+#define DIXMIN   64
+#define NDIXHASH (PGSIZE / sizeof(struct dixent *))
+
+struct dixent {
+  struct dixent *next;
+  uint off;
+  ushort inum;         // these two are unused on the free list
+  char name[DIRSIZ];
+};
+
+struct dirindex {
+  struct dixent **hash;  // a page of NDIXHASH chains
+  struct dixent *free;   // empty dirents
+  int nlive;             // entries in hash
+};
+
+static struct kcache dixcache;
+
+static uint
+dixhash(char *name)
+{
+  uint h = 0;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDIXHASH;
+}
+
+static void
+dixinit(void)
+{
+  kcache_init(&dixcache, "dirindex", sizeof(struct dixent));
+}
+
+// Drop ip's directory index, if any.
+static void
+dixfree(struct inode *ip)
+{
+  struct dirindex *dix = ip->dix;
+  struct dixent *e;
+
+  if(dix == 0)
+    return;
+  ip->dix = 0;
+  for(int i = 0; i < NDIXHASH; i++){
+    while((e = dix->hash[i]) != 0){
+      dix->hash[i] = e->next;
+      kcache_free(&dixcache, e);
+    }
+  }
+  while((e = dix->free) != 0){
+    dix->free = e->next;
+    kcache_free(&dixcache, e);
+  }
+  kfree(dix->hash);
+  kmfree(dix, sizeof(*dix));
+}
+
+// Record the dirent (name, inum) at off in dp's index, or an
+// empty slot if inum is 0. Drops the index if out of memory.
+static void
+dixadd(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dixent *e, **hp;
+
+  if((e = kcache_alloc(&dixcache)) == 0){
+    dixfree(dp);
+    return;
+  }
+  e->off = off;
+  e->inum = inum;
+  if(inum){
+    strncpy(e->name, name, DIRSIZ);
+    hp = &dp->dix->hash[dixhash(name)];
+    dp->dix->nlive++;
+  } else {
+    hp = &dp->dix->free;
+  }
+  e->next = *hp;
+  *hp = e;
+}
+
+// Build an index for dp if it has enough entries. Directories
+// never shrink, so count them rather than trust dp->size.
+static void
+dixbuild(struct inode *dp)
+{
+  struct dirindex *dix;
+  struct dirent de;
+  uint off;
+  int n;
+
+  if(dp->size / sizeof(de) < DIXMIN)
+    return;
+  n = 0;
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dixbuild read");
+    if(de.inum)
+      n++;
+  }
+  if(n < DIXMIN)
+    return;
+  if((dix = kmalloc(sizeof(*dix))) == 0)
+    return;
+  if((dix->hash = kalloc_zeroed()) == 0){
+    kmfree(dix, sizeof(*dix));
+    return;
+  }
+  dix->free = 0;
+  dix->nlive = 0;
+  dp->dix = dix;
+  for(off = 0; off < dp->size && dp->dix; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dixbuild read");
+    dixadd(dp, de.name, de.inum, off);
+  }
+}
+
+// Return the index entry for name in dp, or 0.
+static struct dixent *
+dixlookup(struct inode *dp, char *name)
+{
+  struct dixent *e;
+
+  for(e = dp->dix->hash[dixhash(name)]; e; e = e->next)
+    if(namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Answers from the dcache or the directory's index when it
+// can, and fills the dcache otherwise.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct dixent *e;
+  int r;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if((r = dcache_lookup(dp->dev, dp->inum, name, &inum, &off)) != 0){
+    if(r < 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if(dp->dix == 0)
+    dixbuild(dp);
+  if(dp->dix){
+    if((e = dixlookup(dp, name)) == 0){
+      dcache_enter(dp->dev, dp->inum, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = e->off;
+    dcache_enter(dp->dev, dp->inum, name, e->inum, e->off);
+    return iget(dp->dev, e->inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -545,10 +1273,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcache_enter(dp->dev, dp->inum, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcache_enter(dp->dev, dp->inum, name, 0, 0);
   return 0;
 }
 
@@ -559,6 +1289,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   int off;
   struct dirent de;
   struct inode *ip;
+  struct dixent *e;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -567,21 +1298,58 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->dix){
+    off = dp->size;
+    if((e = dp->dix->free) != 0){
+      dp->dix->free = e->next;
+      off = e->off;
+      kcache_free(&dixcache, e);
+    }
+  } else {
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcache_enter(dp->dev, dp->inum, name, inum, off);
+  if(dp->dix)
+    dixadd(dp, name, inum, off);
 
   return 0;
 }
 
+// Remove the entry for name, at offset off, from directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+  struct dixent *e, **hp;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+  dcache_enter(dp->dev, dp->inum, name, 0, 0);
+  if(dp->dix){
+    for(hp = &dp->dix->hash[dixhash(name)]; (e = *hp) != 0; hp = &e->next){
+      if(e->off == off){
+        *hp = e->next;
+        e->next = dp->dix->free;
+        dp->dix->free = e;
+        if(--dp->dix->nlive < DIXMIN)
+          dixfree(dp);
+        break;
+      }
+    }
+  }
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -629,11 +1397,17 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct mm *m;
 
-  if(*path == '/')
+  if(*path == '/'){
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  } else {
+    // another thread may be in chdir().
+    m = myproc()->mm;
+    acquire(&m->lock);
+    ip = idup(m->cwd);
+    release(&m->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
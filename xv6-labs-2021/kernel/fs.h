@@ -3,7 +3,11 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+// block size. with make BSIZE=4096 blocks are page-sized, so
+// that a page of a file takes one buf and one disk request.
+#ifndef BSIZE
+#define BSIZE 1024
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -24,9 +28,10 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +40,27 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
+// Extent-mapped files. If addrs[0] is EXTMAGIC, the rest of
+// addrs[] holds extents instead of block numbers: NIEXTENT
+// inline extents, then the number of extents in use, then the
+// address of a block holding up to NBEXTENT more. Extent k maps
+// the len file blocks that follow those of extents 0..k-1 onto
+// disk blocks start, start+1, ..., start+len-1.
+struct extent {
+  uint start;
+  uint len;
+};
+
+#define EXTMAGIC 0xffffffff
+#define NIEXTENT 5
+#define NBEXTENT (BSIZE / sizeof(struct extent))
+#define NEXTENT  (NIEXTENT + NBEXTENT)
+#define EXTCNT   (1 + 2*NIEXTENT)  // addrs[EXTCNT]: number of extents
+#define EXTBLK   (EXTCNT + 1)      // addrs[EXTBLK]: block of more extents
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -0,0 +1,135 @@
+// Futexes: blocking for user-space locks.
+//
+// A user lock takes its fast path with atomic instructions on
+// an int in its own memory, and only calls futex_wait() to park
+// once it finds the lock contended, and futex_wake() to unpark
+// a waiter.
+//
+// A waiter is queued under a key for the int. In private memory
+// the key is the mm and the user address, which threads share,
+// and which stay put when a fork() moves the int to a new
+// copy-on-write page. In a MAP_SHARED page, which processes
+// share, the key is the int's physical address, which a shared
+// page keeps while mapped.
+//
+// futexwait() rechecks the int and queues itself under the lock
+// of the key's bucket, and futexwake() dequeues under that lock,
+// so a wake between a waiter's check and its sleep is not lost.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 31
+#define FUTEXHASH(k) ((((k).key >> 2) + (uint64)(k).mm) % NFUTEX)
+
+struct futexkey {
+  struct mm *mm;  // 0 for a MAP_SHARED page
+  uint64 key;     // user address in mm, or physical address
+};
+
+// A parked thread, on its kernel stack.
+struct futexq {
+  struct futexq *next;
+  struct futexkey k;
+  int woken;
+};
+
+static struct {
+  struct spinlock lock;
+  struct futexq *head;
+} futex[NFUTEX];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futex[i].lock, "futex");
+}
+
+// Fill in *k for the int at user address addr.
+// Returns 0, or -1 if addr is bad.
+static int
+futexkey(uint64 addr, struct futexkey *k)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0 || (pa = uvmpa(p->pagetable, addr)) == 0)
+    return -1;
+  if(mmapshared(p, addr)){
+    k->mm = 0;
+    k->key = pa;
+  } else {
+    k->mm = p->mm;
+    k->key = addr;
+  }
+  return 0;
+}
+
+// If the int at user address addr still holds val, sleep
+// until futexwake() on addr. Returns 0 when woken, or -1 if
+// *addr != val, addr is bad, or the process was killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct futexq q, **qq;
+  uint64 pa;
+  int i;
+
+  if(futexkey(addr, &q.k) < 0)
+    return -1;
+  i = FUTEXHASH(q.k);
+  acquire(&futex[i].lock);
+  // the page may have moved since, or been unmapped.
+  pa = uvmpa(p->pagetable, addr);
+  if(pa == 0 || (q.k.mm == 0 && pa != q.k.key) || *(volatile int*)pa != val){
+    release(&futex[i].lock);
+    return -1;
+  }
+  q.woken = 0;
+  q.next = futex[i].head;
+  futex[i].head = &q;
+  while(!q.woken && !p->killed)
+    sleep(&q, &futex[i].lock);
+  if(!q.woken){
+    for(qq = &futex[i].head; *qq != &q; qq = &(*qq)->next)
+      ;
+    *qq = q.next;
+  }
+  release(&futex[i].lock);
+  return q.woken ? 0 : -1;
+}
+
+// Wake at most n of the processes sleeping in futexwait() on
+// user address addr. Returns how many it woke, or -1.
+int
+futexwake(uint64 addr, int n)
+{
+  struct futexkey k;
+  struct futexq *q, **qq;
+  int i, r;
+
+  if(n < 0 || futexkey(addr, &k) < 0)
+    return -1;
+  i = FUTEXHASH(k);
+  r = 0;
+  acquire(&futex[i].lock);
+  for(qq = &futex[i].head; r < n && (q = *qq) != 0; ){
+    if(q->k.mm == k.mm && q->k.key == k.key){
+      *qq = q->next;
+      q->woken = 1;
+      wakeup(q);
+      r++;
+    } else {
+      qq = &q->next;
+    }
+  }
+  release(&futex[i].lock);
+  return r;
+}
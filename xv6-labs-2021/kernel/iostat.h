@@ -0,0 +1,15 @@
+// Disk and buffer cache counters, as iostat() reports them.
+// Times are in ticks of the time CSR (10MHz in qemu).
+struct iostat {
+  uint64 nread;         // # of disk read requests
+  uint64 nwrite;        // # of disk write requests
+  uint64 rbytes;        // bytes read from the disk
+  uint64 wbytes;        // bytes written to the disk
+  uint64 svctime;       // total time from submit to completion
+  uint64 maxsvctime;    // longest single request
+  uint64 maxinflight;   // most descriptors in use at once
+  uint64 inflight;      // descriptors in use, summed over time
+  uint64 elapsed;       // time the disk has been up
+  uint64 bhit;          // bread()s that found the block cached
+  uint64 bmiss;         // bread()s that had to read the disk
+};
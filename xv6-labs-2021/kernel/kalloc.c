@@ -1,6 +1,29 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list and lock, so that kalloc()
+// and kfree() on different harts do not contend. A CPU whose
+// list is empty steals a batch of pages from another CPU.
+//
+// Pages can be shared by several page tables (copy-on-write
+// fork), so each page has a reference count. kalloc() sets it
+// to one, kdup() adds a reference, and kfree() only puts the
+// page back on a free list when the last reference is dropped.
+//
+// An idle CPU zeroes free pages ahead of time, see kzeroidle(),
+// and kalloc_zeroed() hands them out. Pages are filled with junk
+// on kalloc() and kfree() only in a KJUNK=1 debug build.
+//
+// When memory runs out, the page cache gives back the pages
+// that no process has mapped, see pcache_reclaim(), and the
+// slab allocator the slabs that only hold free objects, see
+// kcache_reclaim().
+//
+// kinit() does not free every page at boot, which would write
+// to each of them. Instead it gives each CPU an equal slice of
+// never-used memory, [fresh, freshend), and kalloc() carves
+// pages off the front of a slice once the free lists run dry.
 
 #include "types.h"
 #include "param.h"
@@ -9,57 +32,206 @@
 #include "riscv.h"
 #include "defs.h"
 
-void freerange(void *pa_start, void *pa_end);
-
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define NSTEAL 64   // pages moved per steal from another CPU
+#define NZERO  256  // pre-zeroed pages each CPU keeps at most
+
+#ifdef KJUNK
+#define JUNK(pa, c) memset((pa), (c), PGSIZE)
+#else
+#define JUNK(pa, c)
+#endif
+
 struct run {
   struct run *next;
 };
 
+// reference count of each physical page, indexed by PA2REF(pa).
+// updated with atomic instructions, so no lock is needed.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int pageref[(PHYSTOP - KERNBASE) / PGSIZE];
+
+// indexed by cpuid(), like cpus[].
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  struct run *zerolist;  // free pages that are all zeros but for next
+  int nzero;             // length of zerolist
+  char *fresh;           // never-used pages, not on any list
+  char *freshend;
+} kmem[NCPU];
+
+// pages kzeroidle() has off the lists while it zeroes them.
+static int nzeroing;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  char *p, *e;
+  uint64 n;
+
+  p = (char*)PGROUNDUP((uint64)end);
+  n = ((char*)PHYSTOP - p) / PGSIZE;
+  for(int i = 0; i < NCPU; i++){
+    initlock(&kmem[i].lock, "kmem");
+    e = p + (n / NCPU + (i < n % NCPU)) * PGSIZE;
+    kmem[i].fresh = p;
+    kmem[i].freshend = e;
+    p = e;
+  }
 }
 
-void
-freerange(void *pa_start, void *pa_end)
+// Take one never-used page from CPU k's slice, or 0.
+// Caller must hold kmem[k].lock.
+static struct run*
+carve(int k)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  struct run *r;
+
+  if(kmem[k].fresh == kmem[k].freshend)
+    return 0;
+  r = (struct run*)kmem[k].fresh;
+  kmem[k].fresh += PGSIZE;
+  return r;
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
+// Drops one reference; the page goes on the current CPU's
+// free list when no references remain.
 void
 kfree(void *pa)
 {
   struct run *r;
+  int id, ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(&pageref[PA2REF(pa)], 1);
+  if(ref < 0)
+    panic("kfree: ref");
+  if(ref > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  JUNK(pa, 1);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  release(&kmem[id].lock);
+  pop_off();
+}
+
+// Take up to NSTEAL pages from some other CPU's free list.
+// Keep the first for the caller and put the rest on CPU id's
+// list. Failing that, take a page from another CPU's slice of
+// never-used memory. Never holds two kmem locks at once.
+// Interrupts must be disabled.
+static struct run*
+steal(int id)
+{
+  struct run *r, *last;
+  int i, n;
+
+  for(i = 0; i < NCPU; i++){
+    if(i == id)
+      continue;
+    acquire(&kmem[i].lock);
+    r = kmem[i].freelist;
+    if(r == 0){
+      r = carve(i);
+      release(&kmem[i].lock);
+      if(r)
+        return r;
+      continue;
+    }
+    last = r;
+    for(n = 1; n < NSTEAL && last->next; n++)
+      last = last->next;
+    kmem[i].freelist = last->next;
+    release(&kmem[i].lock);
+
+    last->next = 0;
+    if(r->next){
+      acquire(&kmem[id].lock);
+      last->next = kmem[id].freelist;
+      kmem[id].freelist = r->next;
+      release(&kmem[id].lock);
+    }
+    return r;
+  }
+  return 0;
+}
+
+// Pop a page off some CPU's list of zeroed pages, trying
+// CPU id's own first, and clear its next field.
+// Interrupts must be disabled.
+static struct run*
+takezero(int id)
+{
+  struct run *r;
+  int i, k;
+
+  for(i = 0; i < NCPU; i++){
+    k = (id + i) % NCPU;
+    if(__atomic_load_n(&kmem[k].zerolist, __ATOMIC_RELAXED) == 0)
+      continue;
+    acquire(&kmem[k].lock);
+    r = kmem[k].zerolist;
+    if(r){
+      kmem[k].zerolist = r->next;
+      kmem[k].nzero--;
+    }
+    release(&kmem[k].lock);
+    if(r){
+      r->next = 0;
+      return r;
+    }
+  }
+  return 0;
+}
+
+// Take a free page for CPU id: from its free list or its slice
+// of never-used memory, by stealing from another CPU, and
+// failing those from a zeroed list. Once memory runs that low,
+// wait for pages being zeroed rather than fail. Interrupts must
+// be disabled.
+static struct run*
+takefree(int id)
+{
+  struct run *r;
+
+  do {
+    acquire(&kmem[id].lock);
+    r = kmem[id].freelist;
+    if(r)
+      kmem[id].freelist = r->next;
+    else
+      r = carve(id);
+    release(&kmem[id].lock);
+    if(r == 0)
+      r = steal(id);
+    if(r == 0)
+      r = takezero(id);
+  } while(r == 0 && __atomic_load_n(&nzeroing, __ATOMIC_SEQ_CST) > 0);
+  return r;
+}
+
+// Memory has run out: have the kernel's caches give back what
+// they can. Returns the number of pages freed.
+static int
+reclaim(void)
+{
+  return pcache_reclaim() + kcache_reclaim();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +242,188 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  r = takefree(cpuid());
+  pop_off();
+  if(r == 0 && reclaim() > 0){
+    push_off();
+    r = takefree(cpuid());
+    pop_off();
+  }
+
+  if(r){
+    pageref[PA2REF(r)] = 1;
+    JUNK(r, 5); // fill with junk
+  }
+  return (void*)r;
+}
+
+// Allocate one page filled with zeros, preferably one
+// that kzeroidle() has already cleared.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  push_off();
+  r = takezero(cpuid());
+  pop_off();
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if(r == 0){
+    if((r = kalloc()) != 0)
+      memset(r, 0, PGSIZE);
+    return r;
+  }
+  pageref[PA2REF(r)] = 1;
   return (void*)r;
 }
+
+// Allocate up to n pages into pa[], taking the free list
+// lock once rather than once per page.
+// Returns the number allocated, which is less than n
+// only if memory is exhausted.
+int
+kallocn(void **pa, int n)
+{
+  struct run *r;
+  int id, i;
+
+  push_off();
+  id = cpuid();
+  i = 0;
+  while(i < n){
+    acquire(&kmem[id].lock);
+    while(i < n && (r = kmem[id].freelist) != 0){
+      kmem[id].freelist = r->next;
+      pa[i++] = r;
+    }
+    release(&kmem[id].lock);
+    if(i == n || (r = takefree(id)) == 0)
+      break;
+    pa[i++] = r;
+  }
+  pop_off();
+
+  for(int j = 0; j < i; j++){
+    pageref[PA2REF(pa[j])] = 1;
+    JUNK(pa[j], 5); // fill with junk
+  }
+  if(i < n && reclaim() > 0)
+    i += kallocn(pa + i, n - i);
+  return i;
+}
+
+// Like kallocn(), but the pages are filled with zeros.
+int
+kallocn_zeroed(void **pa, int n)
+{
+  struct run *r;
+  int i, m;
+
+  push_off();
+  for(i = 0; i < n && (r = takezero(cpuid())) != 0; i++){
+    pageref[PA2REF(r)] = 1;
+    pa[i] = r;
+  }
+  pop_off();
+
+  m = kallocn(pa + i, n - i);
+  for(int j = i; j < i + m; j++)
+    memset(pa[j], 0, PGSIZE);
+  return i + m;
+}
+
+// Drop a reference to each of the n pages in pa[], like
+// kfree(), and put those that are now free on the current
+// CPU's free list all at once.
+void
+kfreen(void **pa, int n)
+{
+  struct run *r, *head, *tail;
+  int id, ref;
+
+  head = tail = 0;
+  for(int i = 0; i < n; i++){
+    if(((uint64)pa[i] % PGSIZE) != 0 || (char*)pa[i] < end || (uint64)pa[i] >= PHYSTOP)
+      panic("kfreen");
+    ref = __sync_sub_and_fetch(&pageref[PA2REF(pa[i])], 1);
+    if(ref < 0)
+      panic("kfreen: ref");
+    if(ref > 0)
+      continue;
+
+    // Fill with junk to catch dangling refs.
+    JUNK(pa[i], 1);
+    r = (struct run*)pa[i];
+    r->next = head;
+    head = r;
+    if(tail == 0)
+      tail = r;
+  }
+  if(head == 0)
+    return;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  tail->next = kmem[id].freelist;
+  kmem[id].freelist = head;
+  release(&kmem[id].lock);
+  pop_off();
+}
+
+// Add a reference to an allocated page, which
+// the caller is about to map a second time.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(&pageref[PA2REF(pa)], 1) < 1)
+    panic("kdup: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&pageref[PA2REF(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Called by the scheduler of an idle CPU, with interrupts on:
+// zero one free page and move it to the CPU's zeroed list.
+// Returns 1 if it did, or 0 if the list is full or there
+// are no free pages.
+int
+kzeroidle(void)
+{
+  struct run *r;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r = 0;
+  if(kmem[id].nzero < NZERO){
+    if((r = kmem[id].freelist) != 0)
+      kmem[id].freelist = r->next;
+    else
+      r = carve(id);
+    if(r)
+      __atomic_fetch_add(&nzeroing, 1, __ATOMIC_SEQ_CST);
+  }
+  release(&kmem[id].lock);
+  pop_off();
+  if(r == 0)
+    return 0;
+
+  memset(r, 0, PGSIZE);
+
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].zerolist;
+  kmem[id].zerolist = r;
+  kmem[id].nzero++;
+  release(&kmem[id].lock);
+  __atomic_fetch_sub(&nzeroing, 1, __ATOMIC_SEQ_CST);
+  return 1;
+}
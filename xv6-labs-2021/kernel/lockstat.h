@@ -0,0 +1,7 @@
+// One lock's counters, as lockstat() reports them.
+struct lockstat {
+  char name[16];      // Name of lock, truncated
+  uint64 addr;        // Kernel address of lock, to tell locks apart
+  uint64 nacquire;    // # of acquire()s
+  uint64 nspin;       // # of test-and-sets, or queued waits, that found it held
+};
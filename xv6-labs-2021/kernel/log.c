@@ -6,20 +6,41 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
+#include "trace.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only closed when there are
+// no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves MAXOPBLOCKS of log
+// space, and as many data blocks (see below); an operation that
+// may write more, such as a large write(), reserves what it
+// needs with begin_opn()/end_opn(). Usually begin_opn() just
+// adds to the reservations and returns. But if the open
+// transaction's blocks and the reservations would overflow the
+// log, it asks for the transaction to be closed and sleeps
+// until that has happened.
+//
+// Commits are done by a dedicated kernel thread, log_writer().
+// Once the open transaction has no system calls active, the
+// writer closes it: it takes a private copy of the logged
+// blocks and starts a new, empty open transaction. It then
+// writes the copy to the log and home locations while new
+// system calls run in the new transaction. Transactions that
+// complete while a commit is in progress are thus batched
+// into the next commit.
+//
+// So a system call's changes are not on disk when it returns;
+// fsync() waits for them with log_sync(). With COMMITTICKS
+// set, the writer also lets the open transaction collect the
+// changes of more system calls, committing it only once it is
+// COMMITTICKS old, or full, or someone calls log_sync().
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +49,21 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous, but the blocks of a commit
+// are handed to the disk together, see virtio_disk_rwv().
+//
+// The blocks of regular files are ordered data: log_data()
+// records them apart from the logged blocks, and the commit
+// writes them straight to their home locations before it writes
+// the header, so that file data goes to disk once. A crash before
+// the commit may leave a file with some new data in blocks it
+// already had, but never pointing at blocks with stale contents.
+// Up to LOGSIZE data blocks fit in a transaction.
+//
+// The log may live on a disk of its own, LOGDEV, at the blocks
+// the superblock gives it, so that log writes do not queue
+// behind data writes. The commit writes the data and the log
+// blocks at once, and the header once both are done.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,14 +77,33 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
-  int dev;
-  struct logheader lh;
+  int reserved;    // log blocks the outstanding calls may write.
+  int dreserved;   // data blocks the outstanding calls may write.
+  int closing;     // open transaction is being closed, please wait.
+  int dev;         // device of the file system
+  int ldev;        // device holding the log
+  int seq;         // number of the open transaction
+  int done;        // number of the last transaction committed
+  uint opened;     // ticks when the open transaction got its first block
+  struct logheader lh;        // open transaction
+  struct buf *pin[LOGSIZE];   // cached buffer of each block in lh
+  struct logheader ld;        // open transaction's data blocks
+  struct buf *dpin[LOGSIZE];
+
+  // owned by log_writer():
+  struct logheader clh;       // committing transaction
+  struct buf *cpin[LOGSIZE];
+  struct buf cbuf[LOGSIZE];   // contents of clh's blocks
+  struct logheader cld;       // committing transaction's data
+  struct buf *cdpin[LOGSIZE];
+  struct buf cdbuf[LOGSIZE];
+  struct buf *cbs[LOGSIZE];   // for disk requests, too big for the stack
+  struct buf *cdbs[LOGSIZE];
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void log_writer(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,24 +115,49 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.ldev = LOGDEV;
+  log.seq = 1;
   recover_from_log();
+  kthread(log_writer, "logwriter");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks to their home location,
+// from the on-disk log if recovering, else from the
+// writer's private copy.
 static void
 install_trans(int recovering)
 {
   int tail;
+  struct buf **bs = log.cbs;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    if(recovering){
+      struct buf *lbuf = bread(log.ldev, log.start+tail+1); // read log block
+      struct buf *dbuf = bread(log.dev, log.clh.block[tail]); // read dst
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(lbuf);
+      brelse(dbuf);
+    } else {
+      bs[tail] = &log.cbuf[tail];
+      bs[tail]->dev = log.dev;
+      bs[tail]->blockno = log.clh.block[tail];
+    }
+  }
+
+  if(!recovering){
+    // sort by block number, so that the disk can write runs
+    // of consecutive blocks with one request each.
+    for (tail = 1; tail < log.clh.n; tail++) {
+      struct buf *b = bs[tail];
+      int i;
+      for (i = tail; i > 0 && bs[i-1]->blockno > b->blockno; i--)
+        bs[i] = bs[i-1];
+      bs[i] = b;
+    }
+    virtio_disk_rwv(bs, log.clh.n, 1);  // write dsts to disk
+    for (tail = 0; tail < log.clh.n; tail++)
+      bunpin(log.cpin[tail]);
   }
 }
 
@@ -86,12 +165,12 @@ install_trans(int recovering)
 static void
 read_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.ldev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -102,12 +181,12 @@ read_head(void)
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.ldev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -118,7 +197,7 @@ recover_from_log(void)
 {
   read_head();
   install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
@@ -126,85 +205,257 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS, MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS, MAXOPBLOCKS);
+}
+
+// start an FS operation that may write up to n logged
+// blocks and nd data blocks.
+void
+begin_opn(int n, int nd)
+{
+  if(n > LOGSIZE || n > log.size - 1 || nd > LOGSIZE)
+    panic("begin_opn");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.reserved + n > LOGSIZE ||
+              log.ld.n + log.dreserved + nd > LOGSIZE){
+      // this op might exhaust log space; close the transaction.
+      log.closing = 1;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      log.dreserved += nd;
       release(&log.lock);
+      trace(TR_BEGINOP, 0);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// end an operation started by begin_opn(n, nd).
+// wakes the log writer if this was the last outstanding operation.
 void
-end_op(void)
+end_opn(int n, int nd)
 {
-  int do_commit = 0;
-
+  trace(TR_ENDOP, 0);
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
+  log.reserved -= n;
+  log.dreserved -= nd;
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
+    wakeup(&log.lh);
+  } else if(!log.closing){
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
-
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
 }
 
-// Copy modified blocks from cache to log.
+// Start copying the committing transaction's blocks to the log.
 static void
 write_log(void)
 {
   int tail;
+  struct buf **bs = log.cbs;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bs[tail] = &log.cbuf[tail];
+    bs[tail]->dev = log.ldev;
+    bs[tail]->blockno = log.start+tail+1;
   }
+  virtio_disk_submit(bs, log.clh.n, 1);  // write the log
+}
+
+// Start writing the committing transaction's data blocks home.
+static void
+write_data(void)
+{
+  int tail, i;
+  struct buf **bs = log.cdbs;
+
+  for (tail = 0; tail < log.cld.n; tail++) {
+    struct buf *b = &log.cdbuf[tail];
+    b->blockno = log.cld.block[tail];
+    for (i = tail; i > 0 && bs[i-1]->blockno > b->blockno; i--)
+      bs[i] = bs[i-1];
+    bs[i] = b;
+  }
+  virtio_disk_submit(bs, log.cld.n, 1);
+}
+
+// Wait for the n disk writes in bs to finish.
+static void
+log_wait(struct buf **bs, int n)
+{
+  for (int i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
+  int tail;
+
+  // the data and the log go to the disk, or disks, together.
+  if (log.cld.n > 0)
+    write_data();    // Write data home before the metadata that refers to it
+  if (log.clh.n > 0)
+    write_log();     // Write modified blocks from private copy to log
+  if (log.cld.n > 0) {
+    log_wait(log.cdbs, log.cld.n);
+    for (tail = 0; tail < log.cld.n; tail++)
+      bunpin(log.cdpin[tail]);
+    log.cld.n = 0;
+  }
+  if (log.clh.n > 0) {
+    log_wait(log.cbs, log.clh.n);
     write_head();    // Write header to disk -- the real commit
     install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
+    log.clh.n = 0;
     write_head();    // Erase the transaction from the log
   }
 }
 
+// Close the open transaction: move its blocks to clh and
+// copy their contents, so that the next transaction can
+// modify the cached blocks while this one commits.
+// Called with log.lock held and no operations outstanding.
+static void
+close_trans(void)
+{
+  int i;
+
+  log.closing = 1;
+  log.clh = log.lh;
+  for (i = 0; i < log.lh.n; i++)
+    log.cpin[i] = log.pin[i];
+  log.lh.n = 0;
+  log.cld = log.ld;
+  for (i = 0; i < log.ld.n; i++)
+    log.cdpin[i] = log.dpin[i];
+  log.ld.n = 0;
+  release(&log.lock);
+
+  // no operation can begin and modify the blocks while closing.
+  for (i = 0; i < log.clh.n; i++) {
+    memmove(log.cbuf[i].data, log.cpin[i]->data, BSIZE);
+  }
+  for (i = 0; i < log.cld.n; i++) {
+    log.cdbuf[i].dev = log.dev;
+    memmove(log.cdbuf[i].data, log.cdpin[i]->data, BSIZE);
+  }
+  bfreeclose();
+
+  acquire(&log.lock);
+  log.closing = 0;
+  wakeup(&log);
+}
+
+// Should the writer close the open transaction now?
+// Caller must hold log.lock.
+static int
+log_due(void)
+{
+  if(log.outstanding > 0)
+    return 0;
+  if(log.closing)
+    return 1;
+  if(log.lh.n == 0 && log.ld.n == 0)
+    return 0;
+  return COMMITTICKS == 0 || ticks - log.opened >= COMMITTICKS;
+}
+
+// The log writer kernel thread: commits each transaction
+// once its last operation has ended, or, with COMMITTICKS,
+// once it is old enough. A transaction may be closed while
+// empty, if begin_op() asked for it only because many
+// operations were outstanding.
+static void
+log_writer(void)
+{
+  int s;
+
+  acquire(&log.lock);
+  for(;;){
+    if(!log_due()){
+      if(log.outstanding == 0 && (log.lh.n > 0 || log.ld.n > 0)){
+        // wait out COMMITTICKS. log_sync() sets closing
+        // before it wakes &ticks under tickslock, so it is
+        // either seen here or wakes the sleep. a wakeup from
+        // begin_op() meanwhile is not lost for long, since
+        // the timer is set for the deadline.
+        uint due = log.opened + COMMITTICKS;
+        release(&log.lock);
+        acquire(&tickslock);
+        if((int)(ticks - due) < 0 && !log.closing){
+          tickwait(due);
+          sleep(&ticks, &tickslock);
+        }
+        release(&tickslock);
+        acquire(&log.lock);
+      } else {
+        sleep(&log.lh, &log.lock);
+      }
+      continue;
+    }
+    s = log.seq++;
+    close_trans();
+    release(&log.lock);
+
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    trace(TR_COMMIT, s);
+    commit();
+    trace(TR_COMMITDONE, s);
+    acquire(&log.lock);
+    log.done = s;
+    wakeup(&log.done);
+  }
+}
+
+// Wait until the changes of every FS operation that has
+// ended are on disk. Must not be called inside a transaction.
+void
+log_sync(void)
+{
+  int s;
+
+  acquire(&log.lock);
+  s = log.seq;
+  if(log.lh.n > 0 || log.ld.n > 0){
+    // close the open transaction: that keeps new operations
+    // out of it, and makes the writer commit it without
+    // waiting out COMMITTICKS.
+    log.closing = 1;
+    wakeup(&log.lh);
+    // the writer may be waiting out COMMITTICKS. it never
+    // holds log.lock and tickslock at once.
+    acquire(&tickslock);
+    wakeup(&ticks);
+    release(&tickslock);
+  } else {
+    s--;    // only the committing transaction, if any
+  }
+  while(log.done < s)
+    sleep(&log.done, &log.lock);
+  release(&log.lock);
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// log_writer() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,10 +466,13 @@ void
 log_write(struct buf *b)
 {
   int i;
+  struct proc *p;
 
   acquire(&log.lock);
   if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
     panic("too big a transaction");
+  if (log.lh.n == 0 && log.ld.n == 0)
+    log.opened = ticks;
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
@@ -228,9 +482,43 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    if((p = myproc()) != 0)
+      p->ru[RU_OUBLOCK]++;
     bpin(b);
+    log.pin[i] = b;
     log.lh.n++;
   }
   release(&log.lock);
 }
 
+// Like log_write(), for a block of a regular file: the data
+// is written home, not to the log, when the transaction
+// commits.
+void
+log_data(struct buf *b)
+{
+  int i;
+  struct proc *p;
+
+  acquire(&log.lock);
+  if (log.ld.n >= LOGSIZE)
+    panic("too much data in a transaction");
+  if (log.lh.n == 0 && log.ld.n == 0)
+    log.opened = ticks;
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  for (i = 0; i < log.ld.n; i++) {
+    if (log.ld.block[i] == b->blockno)
+      break;
+  }
+  log.ld.block[i] = b->blockno;
+  if (i == log.ld.n) {
+    if((p = myproc()) != 0)
+      p->ru[RU_OUBLOCK]++;
+    bpin(b);
+    log.dpin[i] = b;
+    log.ld.n++;
+  }
+  release(&log.lock);
+}
@@ -6,31 +6,81 @@
 
 volatile static int started = 0;
 
+// how long each step of booting took, printed once hart 0
+// is done, so that printing does not slow the boot down.
+#define NPHASE 16
+static struct {
+  char *name;
+  uint64 t;        // time CSR ticks
+} phases[NPHASE];
+static int nphase;
+static uint64 tphase;
+
+// Record that the step called name has just finished.
+static void
+phase(char *name)
+{
+  uint64 t = r_time();
+
+  if(nphase < NPHASE){
+    phases[nphase].name = name;
+    phases[nphase].t = t - tphase;
+    nphase++;
+  }
+  tphase = t;
+}
+
+static void
+printphases(uint64 t0)
+{
+  for(int i = 0; i < nphase; i++)
+    printf("boot: %s %dus\n", phases[i].name,
+           (int)(phases[i].t * 1000000 / TIMEBASE));
+  printf("boot: total %dus\n", (int)((r_time() - t0) * 1000000 / TIMEBASE));
+}
+
 // start() jumps here in supervisor mode on all CPUs.
 void
 main()
 {
   if(cpuid() == 0){
+    uint64 t0 = tphase = r_time();
     consoleinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    phase("console");
     kinit();         // physical page allocator
+    phase("kinit");
     kvminit();       // create kernel page table
+    kmallocinit();   // small-object allocator
     kvminithart();   // turn on paging
+    phase("kvm");
     procinit();      // process table
+    phase("procinit");
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
+    phase("trap");
     binit();         // buffer cache
+    phase("binit");
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    futexinit();     // futex wait channels
+    pollinit();      // poll() wakeups
+    phase("file");
+    profinit();      // profiler device
+    traceinit();     // event trace device
     virtio_disk_init(); // emulated hard disk
+    phase("devices");
     userinit();      // first user process
+    phase("userinit");
     __sync_synchronize();
     started = 1;
+    printphases(t0);
   } else {
     while(started == 0)
       ;
@@ -24,11 +24,16 @@
 // virtio mmio interface
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+#define VIRTIO1 0x10002000
+#define VIRTIO1_IRQ 2
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt pending
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define TIMEBASE 10000000L  // mtime and time CSR ticks per second
+#define TICKTIME (TIMEBASE / 10)  // time CSR ticks per clock tick, see trap.c
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -62,6 +67,10 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   files mapped by mmap(), below MMAPTOP
+//   the other threads' trapframes, see clone()
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(i) (TRAPFRAME - ((i)+1)*PGSIZE)  // of a thread in proc[i]
+#define MMAPTOP THREADFRAME(NPROC-1)
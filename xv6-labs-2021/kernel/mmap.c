@@ -0,0 +1,354 @@
+//
+// Memory-mapped files.
+// mmap() only records a vma; no page is read until the process
+// touches it and vmfault() calls mmapfault(). Stores to a
+// MAP_SHARED page are written back to the file on munmap() or
+// exit(). Mappings are placed top-down below MMAPTOP,
+// and sbrk() may not grow into them.
+//
+// The vmas belong to the mm, shared by all threads of a process,
+// and change only under mm->lock. mmapfault() reads the file
+// without the lock, from a copy of the vma.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Lowest address mapped by any of p's vmas, or MMAPTOP.
+// Caller must hold p->mm->lock, or be p's only thread.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = MMAPTOP;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->f && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map len bytes of f, starting at file offset off, into the
+// current process. Returns the address, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *fv;
+  uint64 addr;
+
+  if(f->type != FD_INODE || len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if((prot & PROT_READ) && !f->readable)
+    return -1;
+  // private stores never reach the file, so need no write access.
+  if((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable)
+    return -1;
+
+  len = PGROUNDUP(len);
+  acquire(&p->mm->lock);
+  addr = mmapbase(p);
+  if(len > addr || addr - len < PGROUNDUP(p->mm->sz)){
+    release(&p->mm->lock);
+    return -1;
+  }
+  addr -= len;
+
+  fv = 0;
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->f == 0){
+      fv = v;
+      break;
+    }
+  }
+  if(fv == 0){
+    release(&p->mm->lock);
+    return -1;
+  }
+
+  fv->addr = addr;
+  fv->len = len;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->off = off;
+  fv->f = filedup(f);
+  release(&p->mm->lock);
+  return addr;
+}
+
+// Return p's vma containing va, or 0.
+static struct vma *
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->f && va >= v->addr && va - v->addr < v->len)
+      return v;
+  return 0;
+}
+
+// Does p map va with a vma that allows stores?
+int
+mmapwritable(struct proc *p, uint64 va)
+{
+  struct vma *v;
+  int r;
+
+  acquire(&p->mm->lock);
+  r = (v = vmalookup(p, va)) != 0 && (v->prot & PROT_WRITE);
+  release(&p->mm->lock);
+  return r;
+}
+
+// Does p map va with a MAP_SHARED vma?
+int
+mmapshared(struct proc *p, uint64 va)
+{
+  struct vma *v;
+  int r;
+
+  acquire(&p->mm->lock);
+  r = (v = vmalookup(p, va)) != 0 && v->flags == MAP_SHARED;
+  release(&p->mm->lock);
+  return r;
+}
+
+// Fill in the page of p's mapped file containing va.
+// Stores fault on pages mapped without PROT_WRITE.
+// Returns 0 on success, -1 if va is not mapped or
+// memory is exhausted.
+int
+mmapfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v, vc;
+  struct inode *ip;
+  char *mem;
+  uint off;
+  int perm, locked;
+
+  // reading the file may sleep, which a copyin() or copyout()
+  // under a spinlock, as in pipewrite(), must not do.
+  if(mycpu()->noff > 0)
+    return -1;
+  acquire(&p->mm->lock);
+  if((v = vmalookup(p, va)) == 0 || (write && (v->prot & PROT_WRITE) == 0)){
+    release(&p->mm->lock);
+    return -1;
+  }
+  // another thread may munmap() while this one reads.
+  vc = *v;
+  v = &vc;
+  filedup(v->f);
+  release(&p->mm->lock);
+  va = PGROUNDDOWN(va);
+  off = v->off + (va - v->addr);
+
+  // the hardware has no write-only pages. set A up front, and D
+  // only for a store, for hardware that faults rather than set
+  // them itself: munmap() writes back only pages with D set.
+  perm = PTE_U | PTE_A;
+  if(write)
+    perm |= PTE_D;
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  // a read() or write() of this very file may fault here with the
+  // inode already locked, while copying to or from the mapping.
+  ip = v->f->ip;
+  if((locked = holdingsleep(&ip->lock)) == 0)
+    ilock(ip);
+  if(!write && v->flags == MAP_PRIVATE && off + PGSIZE <= ip->size &&
+     (mem = pcache_get(ip, off)) != 0){
+    // share the page cache's copy until the first store. the
+    // page is copy-on-write even if the mapping is read-only,
+    // so that no store through this page table, not even the
+    // kernel's copyout(), can reach the cache's copy;
+    // vmfault() refuses stores to read-only mappings.
+    perm |= PTE_COW;
+  } else {
+    // past the end of the file reads as zeros.
+    if((mem = kalloc_zeroed()) == 0){
+      if(!locked)
+        iunlock(ip);
+      fileclose(v->f);
+      return -1;
+    }
+    readi(ip, 0, (uint64)mem, off, PGSIZE);
+    if(v->prot & PROT_WRITE)
+      perm |= PTE_W;
+  }
+  if(!locked)
+    iunlock(ip);
+
+  acquire(&p->mm->lock);
+  if(vmalookup(p, va) == 0){
+    // unmapped meanwhile.
+    release(&p->mm->lock);
+    kfree(mem);
+    fileclose(v->f);
+    return -1;
+  }
+  if(uvminstall(p->pagetable, va, mem, perm) != 0){
+    release(&p->mm->lock);
+    fileclose(v->f);
+    return -1;
+  }
+  release(&p->mm->lock);
+  fileclose(v->f);
+  return 0;
+}
+
+// Write the page at pa back to v's file, for the mapped
+// address va. Never extends the file.
+static void
+mmapwrite(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;   // fits in a begin_op()
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    if(n > ip->size - (off + i))
+      n = ip->size - (off + i);
+    writei(ip, 0, pa + i, off + i, n);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Unmap [addr, addr+len) of v in p, writing dirty
+// shared pages back to the file first.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if(v->flags == MAP_SHARED && (v->prot & PROT_WRITE)){
+    for(a = addr; a < addr + len; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_D))
+        mmapwrite(v, a, PTE2PA(*pte));
+    }
+  }
+  uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+}
+
+// Unmap [addr, addr+len) from the current process. The range may
+// cover the start, the end or the whole of one mapping, but may
+// not punch a hole in it. Returns 0, or -1 on a bad range.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, vc;
+  struct file *f;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  acquire(&p->mm->lock);
+  if((v = vmalookup(p, addr)) == 0 || len > v->len - (addr - v->addr) ||
+     (addr != v->addr && addr + len != v->addr + v->len)){
+    release(&p->mm->lock);
+    return -1;
+  }
+
+  // detach the range first, so that no other thread faults
+  // it back in while it is written back.
+  vc = *v;
+  if(len == v->len){
+    v->f = 0;
+    v->addr = 0;
+  } else if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+    v->len -= len;
+    filedup(vc.f);
+  } else {
+    v->len -= len;
+    filedup(vc.f);
+  }
+  release(&p->mm->lock);
+
+  vmaunmap(p, &vc, addr, len);
+  f = vc.f;
+  fileclose(f);
+  return 0;
+}
+
+// Give child np copies of p's mappings. Pages already faulted
+// in are shared: really so for MAP_SHARED, copy-on-write for
+// MAP_PRIVATE. Returns 0, or -1 if memory is exhausted, in
+// which case np is left with no mappings.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  int i;
+  struct vma *v;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->mm->vma[i];
+    if(v->f == 0)
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+                v->flags == MAP_PRIVATE) < 0)
+      goto err;
+    np->mm->vma[i] = *v;
+    np->mm->vma[i].f = filedup(v->f);
+  }
+  return 0;
+
+ err:
+  for(v = np->mm->vma; v < &np->mm->vma[NVMA]; v++){
+    if(v->f){
+      uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+      fileclose(v->f);
+      v->f = 0;
+    }
+  }
+  return -1;
+}
+
+// Remove all of p's mappings, as on exit() or exec().
+void
+mmapexit(struct proc *p)
+{
+  struct vma *v;
+  struct file *f;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->f){
+      vmaunmap(p, v, v->addr, v->len);
+      f = v->f;
+      v->f = 0;
+      v->addr = 0;
+      fileclose(f);
+    }
+  }
+}
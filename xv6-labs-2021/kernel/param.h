@@ -1,25 +1,40 @@
+#ifndef NPROC            // e.g. make NPROC=20
 #ifdef LAB_FS
 #define NPROC        10  // maximum number of processes
 #else
 #define NPROC        64  // maximum number of processes (speedsup bigfile)
 #endif
+#endif
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduling priority levels
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mapped regions per process, see mmap.c
+#define NEXECSEG      4  // loadable segments per executable
+#define NINODE       50  // in-memory i-nodes before iget() recycles free ones
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#ifndef LOGDEV
+#define LOGDEV        ROOTDEV  // device holding the root file system's log
+#endif
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#ifndef LOGSIZE
+#define LOGSIZE      (MAXOPBLOCKS*20)  // max data blocks in on-disk log
+#endif
+#ifndef COMMITTICKS
+#define COMMITTICKS  0   // ticks the log may wait before commit; 0: commit when idle
+#endif
+#define WRITEOPBLOCKS (LOGSIZE/2)  // max # of logged, and of data, blocks one write() transaction writes
+#define NBUF         (LOGSIZE*4+MAXOPBLOCKS*3)  // size of disk block cache
+// size of file system in blocks; the sizes are for 1KB blocks
+// and scaled for other ones, see BSIZE in fs.h.
 #ifdef LAB_FS
-#define FSSIZE       200000  // size of file system in blocks
+#define FSSIZE       (200000*1024 / BSIZE)
 #else
 #ifdef LAB_LOCK
-#define FSSIZE       10000  // size of file system in blocks
+#define FSSIZE       (10000*1024 / BSIZE)
 #else
-#define FSSIZE       2000   // size of file system in blocks
+#define FSSIZE       (2000*1024 / BSIZE)
 #endif
 #endif
 #define MAXPATH      128   // maximum file path name
@@ -0,0 +1,286 @@
+// Page cache.
+//
+// Holds whole pages of the contents of regular files, keyed by
+// (inode, offset). readi() of a regular file copies from it, and
+// fills it from the buffer cache on a miss; writei() keeps it up
+// to date. exec() and private mmap()s map its pages copy-on-write,
+// so processes running the same program, or mapping the same file,
+// share the physical pages, and a store gets a private copy. The
+// cache keeps one reference to each page and each mapping another,
+// so a page stays while anyone uses it.
+//
+// Pages read for readi() and mmap() start at page-aligned offsets.
+// exec() may also cache pages at the unaligned file offsets of a
+// program's segments; writei() and itrunc() drop those, rather
+// than find the ones a write overlaps.
+//
+// The cache has no fixed size: it grows into free memory, and
+// when kalloc() runs out it asks pcache_reclaim() to free the
+// least recently used pages that no process has mapped. An
+// inode's pages are dropped when its in-memory copy is recycled.
+// A few dropped entries are kept on a spare list, for the next
+// pages read in; the rest go back to their kcache, so that its
+// slabs shrink with the cache.
+//
+// pcache.lock protects the hash table, the LRU list, and the
+// page lists in the inodes. A page's contents change only under
+// its inode's sleep-lock, and only while no process maps it.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "sleeplock.h"
+#include "slab.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCHASH   1021
+#define NRECLAIM  64     // most pages one pcache_reclaim() frees
+#define NSPARE    8      // most unused entries kept
+#define PCHASH(ip, off) ((((uint64)(ip) >> 4) * 31 + (off) / PGSIZE) % NPCHASH)
+
+struct cpage {
+  struct inode *ip;
+  uint off;              // file offset of the page's first byte
+  char *pa;
+  struct cpage *hnext;   // hash chain
+  struct cpage **hprev;
+  struct cpage *inext;   // ip's pages
+  struct cpage **iprev;
+  struct cpage *lnext;   // LRU list, most recently used first
+  struct cpage *lprev;
+};
+
+static struct {
+  struct spinlock lock;
+  struct kcache cache;   // struct cpage
+  struct cpage lru;      // head of the LRU list
+  struct cpage *spare;   // unused entries, through hnext
+  int nspare;
+  struct cpage *hash[NPCHASH];
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  kcache_init(&pcache.cache, "cpage", sizeof(struct cpage));
+  pcache.lru.lnext = pcache.lru.lprev = &pcache.lru;
+}
+
+// Move c to the front of the LRU list.
+// Caller must hold pcache.lock.
+static void
+pcache_touch(struct cpage *c)
+{
+  c->lprev->lnext = c->lnext;
+  c->lnext->lprev = c->lprev;
+  c->lnext = pcache.lru.lnext;
+  c->lprev = &pcache.lru;
+  pcache.lru.lnext->lprev = c;
+  pcache.lru.lnext = c;
+}
+
+// Return the cached page of ip at off, or 0.
+// Caller must hold pcache.lock.
+static struct cpage *
+pcache_lookup(struct inode *ip, uint off)
+{
+  struct cpage *c;
+
+  for(c = pcache.hash[PCHASH(ip, off)]; c; c = c->hnext)
+    if(c->ip == ip && c->off == off)
+      return c;
+  return 0;
+}
+
+// Keep the unused entry c as a spare, or free it.
+// Caller must hold pcache.lock.
+static void
+pcache_spare(struct cpage *c)
+{
+  if(pcache.nspare >= NSPARE){
+    kcache_free(&pcache.cache, c);
+    return;
+  }
+  c->hnext = pcache.spare;
+  pcache.spare = c;
+  pcache.nspare++;
+}
+
+// Forget c and give up the cache's reference to its page.
+// Caller must hold pcache.lock.
+static void
+pcache_drop(struct cpage *c)
+{
+  if((*c->hprev = c->hnext) != 0)
+    c->hnext->hprev = c->hprev;
+  if((*c->iprev = c->inext) != 0)
+    c->inext->iprev = c->iprev;
+  c->lprev->lnext = c->lnext;
+  c->lnext->lprev = c->lprev;
+  kfree(c->pa);
+  pcache_spare(c);
+}
+
+// Return the page holding the PGSIZE bytes of ip at off, with a
+// reference for the caller, reading it in if it is not cached.
+// Bytes past the end of the file read as zeros. Returns 0 if out
+// of memory. Caller must hold ip->lock, so only one process at a
+// time can be reading a given page in.
+char *
+pcache_get(struct inode *ip, uint off)
+{
+  struct cpage *c, **hp;
+  char *mem;
+  int n;
+
+  acquire(&pcache.lock);
+  if((c = pcache_lookup(ip, off)) != 0){
+    pcache_touch(c);
+    kdup(c->pa);
+    release(&pcache.lock);
+    return c->pa;
+  }
+  if((c = pcache.spare) != 0){
+    pcache.spare = c->hnext;
+    pcache.nspare--;
+  }
+  release(&pcache.lock);
+
+  if(c == 0 && (c = kcache_alloc(&pcache.cache)) == 0)
+    return 0;
+  if((mem = kalloc()) == 0){
+    acquire(&pcache.lock);
+    pcache_spare(c);
+    release(&pcache.lock);
+    return 0;
+  }
+  ireadahead(ip, off, PGSIZE);
+  n = readiblk(ip, 0, (uint64)mem, off, PGSIZE);
+  if(n < 0)
+    n = 0;
+  memset(mem + n, 0, PGSIZE - n);
+
+  acquire(&pcache.lock);
+  c->ip = ip;
+  c->off = off;
+  c->pa = mem;
+  hp = &pcache.hash[PCHASH(ip, off)];
+  if((c->hnext = *hp) != 0)
+    c->hnext->hprev = &c->hnext;
+  c->hprev = hp;
+  *hp = c;
+  if((c->inext = ip->pages) != 0)
+    c->inext->iprev = &c->inext;
+  c->iprev = &ip->pages;
+  ip->pages = c;
+  c->lnext = c->lprev = c;
+  pcache_touch(c);
+  if(off % PGSIZE)
+    ip->pcodd = 1;
+  kdup(mem);
+  release(&pcache.lock);
+  return mem;
+}
+
+// Is the page of ip holding off cached?
+int
+pcache_cached(struct inode *ip, uint off)
+{
+  int r;
+
+  acquire(&pcache.lock);
+  r = pcache_lookup(ip, PGROUNDDOWN(off)) != 0;
+  release(&pcache.lock);
+  return r;
+}
+
+// Copy n bytes of ip at off to dst, through the cache, as
+// readi() does. off and n must lie within the file.
+// Caller must hold ip->lock.
+int
+pcache_read(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  char *pa;
+
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    m = n - tot;
+    if(m > PGSIZE - off % PGSIZE)
+      m = PGSIZE - off % PGSIZE;
+    if((pa = pcache_get(ip, PGROUNDDOWN(off))) == 0){
+      // out of memory: read the rest without caching it.
+      if((r = readiblk(ip, user_dst, dst, off, n - tot)) == -1)
+        return -1;
+      return tot + r;
+    }
+    r = either_copyout(user_dst, dst, pa + off % PGSIZE, m);
+    kfree(pa);
+    if(r == -1)
+      return -1;
+  }
+  return tot;
+}
+
+// writei() has written the n bytes at src, all within one page,
+// to ip at off: bring the cached page up to date, or drop it if
+// a process has it mapped. Caller must hold ip->lock.
+void
+pcache_write(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *c, *next;
+
+  acquire(&pcache.lock);
+  if(ip->pcodd){
+    for(c = ip->pages; c; c = next){
+      next = c->inext;
+      if(c->off % PGSIZE)
+        pcache_drop(c);
+    }
+    ip->pcodd = 0;
+  }
+  if((c = pcache_lookup(ip, PGROUNDDOWN(off))) != 0){
+    if(krefcnt(c->pa) > 1)
+      pcache_drop(c);
+    else
+      memmove(c->pa + off % PGSIZE, src, n);
+  }
+  release(&pcache.lock);
+}
+
+// Forget ip's cached pages. Processes that have them mapped
+// keep them. Caller must hold ip->lock, or be the only user
+// of ip.
+void
+pcache_purge(struct inode *ip)
+{
+  acquire(&pcache.lock);
+  while(ip->pages)
+    pcache_drop(ip->pages);
+  ip->pcodd = 0;
+  release(&pcache.lock);
+}
+
+// Free up to NRECLAIM of the least recently used cached
+// pages that no process has mapped. Returns the number freed.
+int
+pcache_reclaim(void)
+{
+  struct cpage *c, *prev;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(c = pcache.lru.lprev; c != &pcache.lru && n < NRECLAIM; c = prev){
+    prev = c->lprev;
+    if(krefcnt(c->pa) == 1){
+      pcache_drop(c);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
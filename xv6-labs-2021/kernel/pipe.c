@@ -3,33 +3,54 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "slab.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
+
+// byte i of the ring, which is kept a page at a time.
+#define PIPEBYTE(pi, i) ((pi)->data[(i) / PGSIZE % PIPEPAGES][(i) % PGSIZE])
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static struct kcache pipecache;
+
+void
+pipeinit(void)
+{
+  kcache_init(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
+  int n;
 
   pi = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kcache_alloc(&pipecache)) == 0)
+    goto bad;
+  if((n = kallocn((void**)pi->data, PIPEPAGES)) < PIPEPAGES){
+    kfreen((void**)pi->data, n);
+    kcache_free(&pipecache, pi);
+    pi = 0;
     goto bad;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -47,7 +68,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kcache_free(&pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,19 +87,26 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup();
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kfreen((void**)pi->data, PIPEPAGES);
+    freelock(&pi->lock);
+    kcache_free(&pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Copy as much as fits in one stretch: up to the end of the
+// current ring page, and no more than the ring can take.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
   struct proc *pr = myproc();
 
+  if(user_src)
+    uvmprefault(addr, n, 0);
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || pr->killed){
@@ -87,16 +115,22 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
+      pollwakeup();
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = n - i;
+      if(m > pi->nread + PIPESIZE - pi->nwrite)
+        m = pi->nread + PIPESIZE - pi->nwrite;
+      if(m > PGSIZE - pi->nwrite % PGSIZE)
+        m = PGSIZE - pi->nwrite % PGSIZE;
+      if(either_copyin(&PIPEBYTE(pi, pi->nwrite), user_src, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
+  pollwakeup();
   release(&pi->lock);
 
   return i;
@@ -105,10 +139,10 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
   struct proc *pr = myproc();
-  char ch;
 
+  uvmprefault(addr, n < PIPESIZE ? n : PIPESIZE, 1);
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
     if(pr->killed){
@@ -117,14 +151,40 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PGSIZE - pi->nread % PGSIZE)
+      m = PGSIZE - pi->nread % PGSIZE;
+    if(copyout(pr->pagetable, addr + i, &PIPEBYTE(pi, pi->nread), m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollwakeup();
   release(&pi->lock);
   return i;
 }
+
+// Is the read end (writable == 0), or the write end, of pi ready?
+int
+pipepoll(struct pipe *pi, int writable)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r = POLLERR;
+    else if(pi->nwrite != pi->nread + PIPESIZE)
+      r = POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r = POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
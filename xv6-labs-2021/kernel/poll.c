@@ -0,0 +1,143 @@
+// poll(): wait until any of several files is ready.
+//
+// sleep() waits on one channel, so a poller cannot sleep on the
+// channels of all its files at once. Instead, every change that
+// may make a pipe or the console ready calls pollwakeup(), which
+// bumps polls.seq and wakes all pollers, and each rescans its
+// files. A poller notes seq before it scans and sleeps only if
+// seq has not moved since, so no wakeup is lost. pollwakeup()
+// costs one load while no process is in poll().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+
+static struct {
+  struct spinlock lock;
+  uint seq;       // bumped by each pollwakeup()
+  int n;          // # of processes in poll()
+  int ntimed;     // # of those with a timeout, woken each tick
+} polls;
+
+void
+pollinit(void)
+{
+  initlock(&polls.lock, "poll");
+}
+
+// Something a poller may wait for has happened. Callers hold
+// the lock of the pipe or device whose state changed, so a
+// poller either sees the change in its scan, or is counted in
+// polls.n by the time the change is made.
+void
+pollwakeup(void)
+{
+  if(__atomic_load_n(&polls.n, __ATOMIC_SEQ_CST) == 0)
+    return;
+  acquire(&polls.lock);
+  polls.seq++;
+  wakeup(&polls.seq);
+  release(&polls.lock);
+}
+
+// Called on each tick, for pollers with a timeout.
+void
+polltick(void)
+{
+  if(__atomic_load_n(&polls.ntimed, __ATOMIC_SEQ_CST))
+    pollwakeup();
+}
+
+// Wait until one of the nfds files described by the array of
+// struct pollfd at user address addr is ready, or for timeout
+// ticks if timeout >= 0. Sets each revents. Returns the number
+// of fds with revents set, 0 on timeout, or -1.
+int
+poll(uint64 addr, int nfds, int timeout)
+{
+  struct proc *p = myproc();
+  struct mm *m = p->mm;
+  struct pollfd fds[NOFILE];
+  struct file *f[NOFILE];
+  uint seq, t0;
+  int i, n;
+
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, nfds * sizeof(fds[0])) < 0)
+    return -1;
+
+  // hold the files, in case another thread closes them.
+  acquire(&m->lock);
+  for(i = 0; i < nfds; i++){
+    f[i] = 0;
+    if(fds[i].fd >= 0 && fds[i].fd < NOFILE && m->ofile[fds[i].fd])
+      f[i] = filedup(m->ofile[fds[i].fd]);
+  }
+  release(&m->lock);
+
+  acquire(&polls.lock);
+  polls.n++;
+  if(timeout > 0)
+    polls.ntimed++;
+  release(&polls.lock);
+  acquire(&tickslock);
+  tickupdate();
+  t0 = ticks;
+  release(&tickslock);
+
+  for(;;){
+    acquire(&polls.lock);
+    seq = polls.seq;
+    release(&polls.lock);
+
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      if(f[i])
+        fds[i].revents = filepoll(f[i], fds[i].events);
+      else
+        fds[i].revents = fds[i].fd >= 0 ? POLLNVAL : 0;
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0)
+      break;
+    if(p->killed){
+      n = -1;
+      break;
+    }
+    if(timeout > 0 && ticks - t0 >= timeout)
+      break;
+
+    if(timeout > 0){
+      acquire(&tickslock);
+      tickwait(t0 + timeout);
+      release(&tickslock);
+    }
+    acquire(&polls.lock);
+    if(polls.seq == seq)
+      sleep(&polls.seq, &polls.lock);
+    release(&polls.lock);
+  }
+
+  acquire(&polls.lock);
+  polls.n--;
+  if(timeout > 0)
+    polls.ntimed--;
+  release(&polls.lock);
+  for(i = 0; i < nfds; i++)
+    if(f[i])
+      fileclose(f[i]);
+
+  if(n >= 0 && copyout(p->pagetable, addr, (char*)fds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+  return n;
+}
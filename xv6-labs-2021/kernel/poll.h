@@ -0,0 +1,12 @@
+// One file descriptor for poll() to watch.
+struct pollfd {
+  int fd;               // ignored if negative
+  short events;         // POLLIN and POLLOUT to wait for
+  short revents;        // set by poll(): which are ready
+};
+
+#define POLLIN   0x01   // read() would not block
+#define POLLOUT  0x04   // write() would not block
+#define POLLERR  0x08   // write end of a pipe with no reader
+#define POLLHUP  0x10   // read end of a pipe with no writer
+#define POLLNVAL 0x20   // fd is not open
@@ -18,11 +18,38 @@
 volatile int panicked = 0;
 
 // lock to avoid interleaving concurrent printf's.
+// printf() collects its output in buf, and hands it
+// to the uart's log buffer a batch at a time.
+// until printfinit(), and after a panic, output
+// goes straight to the uart instead.
+#define PRBUF 128
 static struct {
   struct spinlock lock;
   int locking;
+  char buf[PRBUF];
+  int n;
 } pr;
 
+static void
+prflush(void)
+{
+  if(pr.n > 0)
+    uartputs_async(pr.buf, pr.n);
+  pr.n = 0;
+}
+
+static void
+prputc(int c)
+{
+  if(!pr.locking){
+    uartputc_sync(c);
+    return;
+  }
+  if(pr.n == PRBUF)
+    prflush();
+  pr.buf[pr.n++] = c;
+}
+
 static char digits[] = "0123456789abcdef";
 
 static void
@@ -46,17 +73,17 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    prputc(buf[i]);
 }
 
 static void
 printptr(uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  prputc('0');
+  prputc('x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    prputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the console. only understands %d, %x, %p, %s.
@@ -77,7 +104,7 @@ printf(char *fmt, ...)
   va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      prputc(c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -97,27 +124,30 @@ printf(char *fmt, ...)
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        prputc(*s);
       break;
     case '%':
-      consputc('%');
+      prputc('%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      prputc('%');
+      prputc(c);
       break;
     }
   }
 
-  if(locking)
+  if(locking){
+    prflush();
     release(&pr.lock);
+  }
 }
 
 void
 panic(char *s)
 {
   pr.locking = 0;
+  uartflush_sync();
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -5,11 +5,51 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
+#include "rusage.h"
+#include "wait.h"
 
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
+// each process has its own struct mm, or shares one with the
+// other threads it is made of, so NPROC of them are enough.
+// mm->lock protects mm->ref and mm->nlive.
+struct mm mms[NPROC];
+
+// RUNNABLE processes wait on the run queue of the CPU they
+// last ran on; an idle CPU steals from the others.
+// a process is on a queue from the time it becomes RUNNABLE
+// until a scheduler() takes it off to run it.
+//
+// scheduling is multi-level feedback: each run queue has a
+// FIFO per priority level, and the scheduler runs the highest
+// level first. a process that uses up its time slice drops a
+// level, where slices are longer; one that wakes from sleep
+// goes back to its base level, set by setprio.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+} runq[NCPU];
+
+#define SLICE(prio) (1 << (prio))  // time slice at level prio, in ticks
+#define STARVE 100  // ticks a process may wait before it is boosted
+
+// sleeping processes wait on a queue found by hashing
+// their chan, so that wakeup(chan) only looks at the
+// processes that might be sleeping on chan.
+// a process's chan is only changed with both p->lock
+// and its queue's lock held.
+#define NSLEEPQ 61
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) / 8) % NSLEEPQ])
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
 struct proc *initproc;
 
 int nextpid = 1;
@@ -17,6 +57,8 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void makerunnable(struct proc *p);
+static void kick(int id);
 
 extern char trampoline[]; // trampoline.S
 
@@ -49,11 +91,17 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
-  initlock(&wait_lock, "wait_lock");
+  initqlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
   }
+  for(int i = 0; i < NPROC; i++)
+    initlock(&mms[i].lock, "mm");
 }
 
 // Must be called with interrupts disabled,
@@ -97,12 +145,39 @@ allocpid() {
   return pid;
 }
 
+// Find an unused struct mm, and give it one user.
+static struct mm*
+allocmm(void)
+{
+  struct mm *m;
+
+  for(m = mms; m < &mms[NPROC]; m++){
+    acquire(&m->lock);
+    if(m->ref == 0){
+      m->ref = 1;
+      m->nlive = 1;
+      release(&m->lock);
+      m->sz = 0;
+      // each mms[] slot has its own ASID. the previous
+      // user of the slot may have left entries for it
+      // in any CPU's TLB.
+      m->asid = (m - mms) + 1;
+      m->tlbstale = ~0L;
+      return m;
+    }
+    release(&m->lock);
+  }
+  return 0;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. If share is not 0, the new
+// proc is a thread of share's process, see clone(); otherwise
+// it gets an address space of its own, with no user memory.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *share)
 {
   struct proc *p;
 
@@ -119,21 +194,57 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
-
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  p->cpu = cpuid();
+  p->baseprio = 0;
+  p->prio = 0;
+  p->slice = 0;
+  memset(p->ru, 0, sizeof(p->ru));
+  memset(p->cru, 0, sizeof(p->cru));
+
+  if(share){
+    p->mm = share->mm;
+    acquire(&p->mm->lock);
+    p->mm->ref++;
+    p->mm->nlive++;
+    release(&p->mm->lock);
+  } else if((p->mm = allocmm()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  // Allocate a trapframe page.
+  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
+  p->trapframe->kernel_sp = 0;  // for usertrapret() to fill in
+
+  if(share){
+    // map the trapframe in share's page table, in a place
+    // of its own, for trampoline.S.
+    p->tfva = THREADFRAME(p - proc);
+    if(mappages(share->pagetable, p->tfva, PGSIZE,
+                (uint64)p->trapframe, PTE_R | PTE_W) < 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    // a CPU that ran share's process may hold an entry for
+    // p->tfva, from an earlier thread in this slot.
+    __atomic_store_n(&p->mm->tlbstale, ~0L, __ATOMIC_SEQ_CST);
+    p->pagetable = share->pagetable;
+  } else {
+    // An empty user page table.
+    p->tfva = TRAPFRAME;
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  }
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -145,21 +256,42 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
+// including user pages if no other thread uses them.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  struct mm *m = p->mm;
+  uint64 sz;
+  int last;
+
+  if(m){
+    sz = m->sz;
+    acquire(&m->lock);
+    if(p->state != ZOMBIE)
+      m->nlive--;   // never ran, or never exited
+    last = --m->ref == 0;
+    release(&m->lock);
+    if(p->pagetable && p->trapframe && p->state != ZOMBIE){
+      // exit() unmapped a zombie's trapframe. p never ran, but
+      // the caller need not be running m, so tlbflush() can't
+      // tell the other CPUs.
+      uvmunmap(p->pagetable, p->tfva, 1, 0);
+      __atomic_store_n(&m->tlbstale, ~0L, __ATOMIC_SEQ_CST);
+    }
+    if(p->pagetable && last)
+      proc_freepagetable(p->pagetable, sz);
+  }
+  p->mm = 0;
+  p->pagetable = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
+  p->kfunc = 0;
+  p->spawn = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
@@ -227,44 +359,50 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  p->mm->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  makerunnable(p);
 
   release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Grow or shrink user memory by n bytes. Growing only moves
+// sz; the pages are allocated by vmfault() when they are first
+// touched. Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
+  struct mm *m = p->mm;
 
-  sz = p->sz;
-  if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
-    }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+  acquire(&m->lock);
+  sz = m->sz;
+  if((n > 0 && sz + n >= mmapbase(p)) || (n < 0 && -(uint64)n > sz)){
+    release(&m->lock);
+    return -1;
   }
-  p->sz = sz;
-  return 0;
+  m->sz += n;
+  release(&m->lock);
+
+  // a fault in another thread can no longer map a page
+  // above the new size, see vmfault().
+  if(n < 0)
+    uvmdealloc(p->pagetable, sz, sz + n);
+  return sz;
 }
 
 // Create a new process, copying the parent.
@@ -277,17 +415,26 @@ fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child, while the
+  // parent's other threads, if any, cannot change it.
+  acquire(&p->mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0){
+    release(&p->mm->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->mm->sz = p->mm->sz;
+  if(mmapfork(p, np) < 0){
+    release(&p->mm->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -297,10 +444,153 @@ fork(void)
 
   // increment reference counts on open file descriptors.
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(p->mm->ofile[i])
+      np->mm->ofile[i] = filedup(p->mm->ofile[i]);
+  np->mm->cwd = idup(p->mm->cwd);
+  execfork(p, np);
+  release(&p->mm->lock);
+
+  // the parent's writable pages are now copy-on-write.
+  tlbshootdown(p->pagetable);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->baseprio = p->baseprio;
+  np->prio = p->baseprio;
+  makerunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new thread of the current process, which shares its
+// memory, open files and current directory, and starts running
+// fn(arg) in user space with stack pointer stack. fn must not
+// return, but call exit(), which ends just that thread. The new
+// thread is a child of the caller, with a pid of its own; its
+// parent collects it with join() or wait().
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(p->kfunc)
+    return -1;
+  if((np = allocproc(p)) == 0)
+    return -1;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;   // returning from fn faults
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->baseprio = p->baseprio;
+  np->prio = p->baseprio;
+  makerunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// What spawn() asks of its child. The parent waits while the
+// child execs, so this can live on the parent's kernel stack.
+struct spawn {
+  char *path;
+  char **argv;
+  int r;        // exec()'s result
+  int done;
+};
+
+// A spawn()ed process's very first scheduling by scheduler()
+// will swtch to spawnret, which execs in the new process.
+static void
+spawnret(void)
+{
+  struct proc *p = myproc();
+  struct spawn *sp = p->spawn;
+  int r;
 
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  r = exec(sp->path, sp->argv);
+
+  acquire(&wait_lock);
+  p->spawn = 0;
+  sp->r = r;
+  sp->done = 1;
+  wakeup(sp);
+  release(&wait_lock);
+
+  if(r < 0)
+    exit(-1);
+  p->trapframe->a0 = r;   // argc, as exec()'s return value
+  usertrapret();
+}
+
+// Start a child process running path with arguments argv,
+// without copying this process's memory as fork() would: the
+// child starts with an empty address space and execs in its
+// own context. The child's file descriptor i, for i < nfd, is
+// a copy of this process's fd[i], or closed if fd[i] is -1; its
+// other descriptors are closed. Returns the child's pid, or -1
+// if the child could not be made or its exec() failed.
+int
+spawn(char *path, char **argv, int *fd, int nfd)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct spawn sp;
+
+  if(p->kfunc || nfd < 0 || nfd > NOFILE)
+    return -1;
+  if((np = allocproc(0)) == 0)
+    return -1;
+
+  acquire(&p->mm->lock);
+  for(i = 0; i < nfd; i++){
+    if(fd[i] != -1 && (fd[i] < 0 || fd[i] >= NOFILE || p->mm->ofile[fd[i]] == 0)){
+      release(&p->mm->lock);
+      freeproc(np);
+      release(&np->lock);
+      return -1;
+    }
+  }
+  for(i = 0; i < nfd; i++)
+    if(fd[i] != -1)
+      np->mm->ofile[i] = filedup(p->mm->ofile[fd[i]]);
+  np->mm->cwd = idup(p->mm->cwd);
+  release(&p->mm->lock);
+
+  sp.path = path;
+  sp.argv = argv;
+  sp.done = 0;
+  np->spawn = &sp;
+  np->context.ra = (uint64)spawnret;
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
@@ -312,9 +602,21 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->baseprio = p->baseprio;
+  np->prio = p->baseprio;
+  makerunnable(np);
   release(&np->lock);
 
+  // the child uses path and argv until its exec() is done.
+  acquire(&wait_lock);
+  while(!sp.done)
+    sleep(&sp, &wait_lock);
+  release(&wait_lock);
+
+  if(sp.r < 0){
+    wait(pid, 0, 0, 0);
+    return -1;
+  }
   return pid;
 }
 
@@ -340,23 +642,44 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct mm *m = p->mm;
+  int last;
 
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
+  argfdput(p);
+
+  // other threads may go on using the page table after wait()
+  // frees p's trapframe. unmap it while p is still the running
+  // process, so that the other CPUs are made to flush it.
+  uvmunmap(p->pagetable, p->tfva, 1, 0);
+  tlbshootdown(p->pagetable);
+
+  // the last thread to exit drops what they shared.
+  acquire(&m->lock);
+  last = --m->nlive == 0;
+  release(&m->lock);
+
+  if(last){
+    // Write back and drop mapped files, while they are still open.
+    mmapexit(p);
+
+    // Close all open files.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(m->ofile[fd]){
+        struct file *f = m->ofile[fd];
+        fileclose(f);
+        m->ofile[fd] = 0;
+      }
     }
-  }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+    begin_op();
+    iput(m->cwd);
+    execexit(p);
+    end_op();
+    m->cwd = 0;
+  }
 
   acquire(&wait_lock);
 
@@ -378,14 +701,18 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// Wait for a child process to exit and return its pid: child
+// pid, or any child if pid is -1. Return -1 if this process has
+// no such children, or 0 if options has WNOHANG and none has
+// exited yet. If ruaddr is not 0, copy the usage of the child
+// and of the children it waited for there, as a struct rusage.
 int
-wait(uint64 addr)
+wait(int pid, uint64 addr, uint64 ruaddr, int options)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, i;
   struct proc *p = myproc();
+  uint64 ru[NRU];
 
   acquire(&wait_lock);
 
@@ -393,7 +720,7 @@ wait(uint64 addr)
     // Scan through table looking for exited children.
     havekids = 0;
     for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
+      if(np->parent == p && (pid == -1 || np->pid == pid)){
         // make sure the child isn't still in exit() or swtch().
         acquire(&np->lock);
 
@@ -401,12 +728,19 @@ wait(uint64 addr)
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
+          for(i = 0; i < NRU; i++)
+            ru[i] = np->ru[i] + np->cru[i];
+          ru[RU_STIME] -= ru[RU_UTIME];
+          if((addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                   sizeof(np->xstate)) < 0) ||
+             (ruaddr != 0 && copyout(p->pagetable, ruaddr, (char *)ru,
+                                     sizeof(ru)) < 0)) {
             release(&np->lock);
             release(&wait_lock);
             return -1;
           }
+          for(i = 0; i < NRU; i++)
+            p->cru[i] += np->ru[i] + np->cru[i];
           freeproc(np);
           release(&np->lock);
           release(&wait_lock);
@@ -421,12 +755,142 @@ wait(uint64 addr)
       release(&wait_lock);
       return -1;
     }
+    if(options & WNOHANG){
+      release(&wait_lock);
+      return 0;
+    }
     
     // Wait for a child to exit.
     sleep(p, &wait_lock);  //DOC: wait-sleep
   }
 }
 
+// Copy the current process's usage, or that of the children it
+// has waited for if who is RUSAGE_CHILDREN, to user address addr
+// as a struct rusage. Returns 0, or -1.
+int
+getrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  uint64 ru[NRU];
+
+  if(who == RUSAGE_SELF){
+    memmove(ru, p->ru, sizeof(ru));
+    ru[RU_STIME] += r_time() - p->tstart;   // the current run
+  } else if(who == RUSAGE_CHILDREN){
+    memmove(ru, p->cru, sizeof(ru));
+  } else {
+    return -1;
+  }
+  ru[RU_STIME] -= ru[RU_UTIME];
+  return copyout(p->pagetable, addr, (char *)ru, sizeof(ru));
+}
+
+// Mark p RUNNABLE and append it to the run queue of the
+// CPU it last ran on.
+// Caller must hold p->lock.
+static void
+makerunnable(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+  int prio = p->prio;
+
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  p->rqtime = ticks;
+  if(rq->tail[prio])
+    rq->tail[prio]->rqnext = p;
+  else
+    rq->head[prio] = p;
+  rq->tail[prio] = p;
+  release(&rq->lock);
+
+  kick(p->cpu);
+}
+
+// Wake an idle CPU to run a process that just joined the
+// run queue of CPU id: id itself if it is idle, else any
+// idle CPU, which will steal the process.
+static void
+kick(int id)
+{
+  if(__atomic_load_n(&cpus[id].idle, __ATOMIC_SEQ_CST)){
+    ipi(id);
+    return;
+  }
+  for(int i = 0; i < NCPU; i++){
+    if(i != id && __atomic_load_n(&cpus[i].idle, __ATOMIC_SEQ_CST)){
+      ipi(i);
+      return;
+    }
+  }
+}
+
+// Is any process queued on any run queue?
+static int
+runq_any(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    for(int j = 0; j < NPRIO; j++)
+      if(runq[i].head[j])
+        return 1;
+  return 0;
+}
+
+// Is any process queued on rq at a level above prio?
+static int
+runq_higher(struct runq *rq, int prio)
+{
+  for(int i = 0; i < prio; i++)
+    if(rq->head[i])
+      return 1;
+  return 0;
+}
+
+// Take the next process to run off rq, or return 0:
+// the head of the highest non-empty level, unless a
+// process at a lower level has waited too long.
+static struct proc*
+runq_pop(struct runq *rq)
+{
+  struct proc *p;
+  int i, prio;
+
+  // peek without the lock, so that idle CPUs looking
+  // for work do not pull busy queues' locks away.
+  for(i = 0; i < NPRIO; i++)
+    if(rq->head[i])
+      break;
+  if(i == NPRIO)
+    return 0;
+
+  acquire(&rq->lock);
+  p = 0;
+  prio = 0;
+  for(i = NPRIO-1; i > 0; i--){
+    if(rq->head[i] && ticks - rq->head[i]->rqtime >= STARVE){
+      p = rq->head[i];
+      prio = i;
+      break;
+    }
+  }
+  for(i = 0; p == 0 && i < NPRIO; i++){
+    if(rq->head[i]){
+      p = rq->head[i];
+      prio = i;
+    }
+  }
+  if(p){
+    rq->head[prio] = p->rqnext;
+    if(rq->head[prio] == 0)
+      rq->tail[prio] = 0;
+    p->rqnext = 0;
+  }
+  release(&rq->lock);
+  return p;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -439,28 +903,59 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
-  
+  int id = c - cpus;
+
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    // memory ran out, see kcache_reclaim().
+    kcache_cpudrain();
+
+    p = runq_pop(&runq[id]);
+    for(int i = 1; p == 0 && i < NCPU; i++)
+      p = runq_pop(&runq[(id + i) % NCPU]);
+    if(p == 0 && kzeroidle())
+      continue;   // zeroed a page for kalloc_zeroed(); look again
+    if(p == 0){
+      // nothing to run: wait for an interrupt. keep interrupts
+      // off, so that an IPI sent by kick() after the check is
+      // not handled before the wfi, which would then sleep
+      // through it; wfi returns as soon as one is pending.
+      intr_off();
+      timerarm();   // no slice to time
+      __atomic_store_n(&c->idle, 1, __ATOMIC_SEQ_CST);
+      if(!runq_any())
+        asm volatile("wfi");
+      __atomic_store_n(&c->idle, 0, __ATOMIC_SEQ_CST);
+      continue;
     }
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if(ticks - p->rqtime >= STARVE)
+      p->prio = p->baseprio;
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    trace(TR_RUN, p->pid);
+    p->tstart = r_time();
+    c->slicend = p->tstart + TICKTIME;
+    timerarm();
+    swtch(&c->context, &p->context);
+    p->ru[RU_STIME] += r_time() - p->tstart;
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    trace(TR_DESCHED, p->pid);
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -487,6 +982,7 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  trace(TR_SCHED, p->state);
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
 }
@@ -497,7 +993,8 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  p->ru[RU_NIVCSW]++;
+  makerunnable(p);
   sched();
   release(&p->lock);
 }
@@ -523,31 +1020,122 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfunc();
+  panic("kthread returned");
+}
+
+// Start a process that runs fn() in the kernel and never
+// returns to user space. fn must not return.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0)
+    panic("kthread");
+  p->kfunc = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  makerunnable(p);
+  release(&p->lock);
+}
+
+// Called on each timer interrupt while p is running.
+// Give up the CPU if p has used up its time slice,
+// moving it down a level, or if a process at a higher
+// level is waiting for this CPU.
+void
+preempt(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  if(++p->slice >= SLICE(p->prio)){
+    p->slice = 0;
+    if(p->prio < NPRIO-1)
+      p->prio++;
+  } else if(!runq_higher(&runq[p->cpu], p->prio)){
+    release(&p->lock);
+    return;
+  }
+  p->ru[RU_NIVCSW]++;
+  makerunnable(p);
+  sched();
+  release(&p->lock);
+}
+
+// Set the base priority level of process pid.
+// 0 is the highest level, NPRIO-1 the lowest.
+int
+setprio(int pid, int prio)
+{
+  struct proc *p;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->baseprio = prio;
+      p->prio = prio;
+      p->slice = 0;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc **pp;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once p is on chan's queue and we hold p->lock,
+  // we can be guaranteed that we won't miss any wakeup
+  // (wakeup looks at the queue, then locks p->lock),
   // so it's okay to release lk.
 
   acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&sq->lock);
+  p->chan = chan;
+  p->sqnext = sq->head;
+  sq->head = p;
+  release(&sq->lock);
   release(lk);
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
+  p->ru[RU_NVCSW]++;
+  trace(TR_SLEEP, (uint64)chan);
 
   sched();
 
   // Tidy up.
+  acquire(&sq->lock);
+  for(pp = &sq->head; *pp != p; pp = &(*pp)->sqnext)
+    ;
+  *pp = p->sqnext;
+  p->sqnext = 0;
   p->chan = 0;
+  release(&sq->lock);
 
   // Reacquire original lock.
   release(&p->lock);
@@ -559,17 +1147,44 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupn(chan, NPROC);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+// Wake up at most max of the processes sleeping on chan,
+// and return how many. Must be called without any p->lock.
+int
+wakeupn(void *chan, int max)
+{
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc *p, *ps[NPROC];
+  int i, n, woken;
+
+  // collect the candidates first: p->lock must not be
+  // acquired while holding sq->lock, since sleep()
+  // acquires them in the other order.
+  n = 0;
+  acquire(&sq->lock);
+  for(p = sq->head; p; p = p->sqnext){
+    if(p->chan == chan && p != myproc())
+      ps[n++] = p;
+  }
+  release(&sq->lock);
+
+  woken = 0;
+  for(i = 0; i < n && woken < max; i++){
+    p = ps[i];
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      // a process that sleeps is likely interactive.
+      p->prio = p->baseprio;
+      p->slice = 0;
+      trace(TR_WAKEUP, p->pid);
+      makerunnable(p);
+      woken++;
     }
+    release(&p->lock);
   }
+  return woken;
 }
 
 // Kill the process with the given pid.
@@ -586,7 +1201,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        makerunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -24,6 +24,11 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // In wfi waiting for work, see scheduler().
+  int tlbreq;                 // Asked to flush its TLB, see tlbshootdown().
+  struct qnode qnode[NQNODE]; // For the queued locks it holds or waits for.
+  uint qbusy;                 // Bitmap of qnode[]s in use.
+  uint64 slicend;             // When proc's time slice ends, see timerarm().
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,8 +85,51 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A file mapped into a process's memory, see mmap.c.
+struct vma {
+  uint64 addr;                 // First mapped address, 0 if unused
+  uint64 len;                  // Length in bytes, a multiple of PGSIZE
+  int prot;                    // PROT_ bits from fcntl.h
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // Mapped file; the vma holds a reference
+  uint off;                    // File offset mapped at addr
+};
+
+// A program segment that exec() left in the executable file,
+// to be read in page by page as it is touched, see execfault().
+struct seg {
+  uint64 va;                   // First address, page-aligned
+  uint64 filesz;               // Bytes from the file; 0 if unused
+  uint off;                    // File offset of va
+};
+
+// What the threads of a process share, see clone(): the address
+// space, open files and current directory. A process that has
+// never called clone() has one of its own.
+// lock must be held to change sz, vma[] and ofile[] while other
+// threads may be using them; the rest change only when there
+// are none, in exec() and exit().
+struct mm {
+  struct spinlock lock;
+  int ref;                     // Procs that use it, freed or not
+  int nlive;                   // Those that have not yet exited
+  uint64 sz;                   // Size of process memory (bytes)
+  int asid;                    // Address-space ID of the page table
+  uint64 tlbstale;             // CPUs whose TLBs may hold stale entries for asid
+  struct vma vma[NVMA];        // Mapped files
+  struct inode *exe;           // Executable file, for seg[]
+  struct seg seg[NEXECSEG];    // Segments not yet read from exe
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// indices of a process's usage counters, in the order of the
+// fields of struct rusage. RU_STIME counts all the time the
+// process runs, user and kernel; see getrusage().
+enum { RU_UTIME, RU_STIME, RU_NVCSW, RU_NIVCSW, RU_NFAULT, RU_INBLOCK, RU_OUBLOCK, NRU };
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -89,20 +137,37 @@ struct proc {
   // p->lock must be held when using these:
   enum procstate state;        // Process state
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *sqnext;         // Next on chan's sleep queue
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p joins
+  int prio;                    // Current priority level, 0 is highest
+  int baseprio;                // Level p returns to on waking, see setprio()
+  int slice;                   // Ticks used of current time slice
+  struct proc *rqnext;         // Next on run queue, under its lock
+  uint rqtime;                 // ticks when p joined its run queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct mm *mm;               // Shared with the process's other threads
+  pagetable_t pagetable;       // User page table, the same for all threads
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // where trapframe is in pagetable
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct file *fref[2];        // Held by argfd() until the syscall returns
+  int nfref;
   char name[16];               // Process name (debugging)
+  void (*kfunc)(void);         // If non-zero, body of a kernel thread
+  struct spawn *spawn;         // What a spawn()ed process is to exec
+
+  // usage counters, changed only by the process itself, or by
+  // the scheduler while the process is switched out to it.
+  uint64 ru[NRU];              // The process's own, see RU_
+  uint64 cru[NRU];             // Summed over waited-for children
+  uint64 tstart;               // r_time() when last switched in
+  uint64 tuser;                // r_time() when it last returned to user space
 };
@@ -0,0 +1,123 @@
+//
+// Sampling profiler.
+// While profiling is on, each CPU's timer interrupt records
+// the interrupted pc, whether it was in user or kernel mode,
+// and the running process in that CPU's sample buffer.
+// The prof device reads them out: writing "1" to it empties
+// the buffers and starts profiling, "0" stops it, and read()
+// returns whole struct profsamples, removing them from the
+// buffers. A full buffer drops new samples until it's read.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFSAMPLE 1024   // samples per CPU
+
+static struct {
+  struct spinlock lock;
+  struct profsample buf[NPROFSAMPLE];
+  uint r;                // read next from buf[r % NPROFSAMPLE]
+  uint w;                // write next to buf[w % NPROFSAMPLE]
+} prof[NCPU];
+
+static volatile int profiling;
+
+// Record that this CPU's timer interrupted pc.
+// Called from usertrap() and kerneltrap(), with interrupts off.
+void
+profsample(uint64 pc, int user)
+{
+  struct proc *p = myproc();
+  struct profsample *s;
+  int id;
+
+  if(!profiling)
+    return;
+  id = cpuid();
+  acquire(&prof[id].lock);
+  if(prof[id].w - prof[id].r < NPROFSAMPLE){
+    s = &prof[id].buf[prof[id].w++ % NPROFSAMPLE];
+    s->pc = pc;
+    s->user = user;
+    if(p){
+      s->pid = p->pid;
+      safestrcpy(s->name, p->name, sizeof(s->name));
+    } else {
+      s->pid = 0;
+      s->name[0] = 0;
+    }
+  }
+  release(&prof[id].lock);
+}
+
+// user read()s from the prof device go here.
+// copy out as many whole samples as fit in n bytes.
+static int
+profread(int user_dst, uint64 dst, int n)
+{
+  struct profsample *s;
+  int i, tot;
+
+  // the copies happen under a spinlock.
+  if(user_dst)
+    uvmprefault(dst, n, 1);
+  tot = 0;
+  for(i = 0; i < NCPU; i++){
+    acquire(&prof[i].lock);
+    while(prof[i].r != prof[i].w && n - tot >= sizeof(*s)){
+      s = &prof[i].buf[prof[i].r % NPROFSAMPLE];
+      if(either_copyout(user_dst, dst + tot, s, sizeof(*s)) == -1){
+        release(&prof[i].lock);
+        return tot > 0 ? tot : -1;
+      }
+      prof[i].r++;
+      tot += sizeof(*s);
+    }
+    release(&prof[i].lock);
+  }
+  return tot;
+}
+
+// user write()s to the prof device go here.
+// "1" starts profiling afresh, "0" stops it.
+static int
+profwrite(int user_src, uint64 src, int n)
+{
+  char c;
+  int i;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) == -1)
+    return -1;
+  if(c == '1'){
+    for(i = 0; i < NCPU; i++){
+      acquire(&prof[i].lock);
+      prof[i].r = prof[i].w = 0;
+      release(&prof[i].lock);
+    }
+    profiling = 1;
+  } else if(c == '0'){
+    profiling = 0;
+  } else {
+    return -1;
+  }
+  return n;
+}
+
+void
+profinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&prof[i].lock, "prof");
+  devsw[PROF].read = profread;
+  devsw[PROF].write = profwrite;
+}
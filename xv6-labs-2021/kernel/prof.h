@@ -0,0 +1,7 @@
+// One sample of the profiler, as read from the prof device.
+struct profsample {
+  uint64 pc;          // Interrupted program counter
+  int pid;            // Running process, or 0 if none
+  int user;           // 1 if pc is a user address
+  char name[16];      // Running process's name
+};
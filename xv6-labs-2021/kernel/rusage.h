@@ -0,0 +1,15 @@
+// Resource usage of a process, as getrusage() and wait3()
+// report it. Times are in ticks of the time CSR (10MHz in qemu).
+// The fields are in the order of the RU_ indices in proc.h.
+struct rusage {
+  uint64 utime;         // time running in user space
+  uint64 stime;         // time running in the kernel
+  uint64 nvcsw;         // times it gave up the CPU to sleep
+  uint64 nivcsw;        // times it was preempted, or yielded
+  uint64 nfault;        // page faults that mapped a page
+  uint64 inblock;       // blocks it read from the disk
+  uint64 oublock;       // blocks it wrote, as log_write() and log_data() see them
+};
+
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN  (-1)   // those it has waited for, and theirs
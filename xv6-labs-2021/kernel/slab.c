@@ -0,0 +1,301 @@
+//
+// Slab allocator for small kernel objects, on top of kalloc().
+//
+// A kcache hands out objects of one size. Each slab is one page:
+// a struct slab header followed by as many objects as fit. Free
+// objects are linked through their first word.
+//
+// Each CPU keeps a magazine of free objects per cache, used with
+// interrupts off and no lock, so most allocations and frees never
+// touch the cache lock. An empty magazine is refilled, and a full
+// one half emptied, under the lock. A slab whose objects are all
+// free, magazines aside, goes back to kalloc() at once; the
+// lock is not held across kalloc(), which may call back into
+// kcache_free() or kcache_reclaim() to find memory.
+//
+// When memory runs out, kcache_reclaim() empties the magazines,
+// so that the slabs their objects pin can be freed. Only a CPU
+// itself may touch its magazines, so other CPUs are asked to
+// empty theirs, which they do in scheduler(), see kcache_cpudrain().
+//
+// kmalloc() and kmfree() serve other sizes from a cache per power
+// of two, and whole pages beyond.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "proc.h"
+#include "defs.h"
+
+struct slab {
+  struct slab *next;      // on the cache's partial list
+  struct slab *prev;
+  struct kcache *cache;
+  void *free;             // free objects in this slab
+  int inuse;              // objects allocated, including in magazines
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+#define KMMIN   32        // smallest kmalloc() size class
+#define NKM     7         // size classes 32 .. 2048
+
+static struct kcache *kcaches;   // all caches, through next
+static int drainreq[NCPU];        // asked to empty magazines
+
+static struct kcache kmcache[NKM];
+static char *kmname[NKM] = {
+  "km32", "km64", "km128", "km256", "km512", "km1024", "km2048"
+};
+
+// Set up cache c. Called only while booting, on one CPU.
+void
+kcache_init(struct kcache *c, char *name, uint size)
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size < sizeof(void*) ? sizeof(void*) : (size + 7) & ~7;
+  if(c->size > PGSIZE - SLABHDR)
+    panic("kcache_init: too big");
+  c->partial = 0;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+  c->next = kcaches;
+  kcaches = c;
+}
+
+static void
+unlink_slab(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+push_slab(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Make a new slab of free objects and put it on c's partial list.
+// Caller must hold c->lock, which is released meanwhile.
+// Returns 0 if out of memory.
+static struct slab *
+newslab(struct kcache *c)
+{
+  struct slab *s;
+  char *o;
+
+  release(&c->lock);
+  s = kalloc();
+  acquire(&c->lock);
+  if(s == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(o = (char*)s + PGSIZE - c->size; o >= (char*)s + SLABHDR; o -= c->size){
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  push_slab(c, s);
+  return s;
+}
+
+// Move up to n free objects from c's slabs into m.
+// Caller must hold c->lock. m may lose objects to a
+// kcache_reclaim() while newslab() is in kalloc().
+static void
+refill(struct kcache *c, struct kmag *m, int n)
+{
+  struct slab *s;
+  void *o;
+
+  while(m->n < n){
+    if((s = c->partial) == 0 && (s = newslab(c)) == 0)
+      break;
+    while(m->n < n && (o = s->free) != 0){
+      s->free = *(void**)o;
+      s->inuse++;
+      m->obj[m->n++] = o;
+    }
+    if(s->free == 0)
+      unlink_slab(c, s);
+  }
+}
+
+// Return the last n objects in m to their slabs, and slabs
+// that become empty to kalloc(). Caller must hold c->lock.
+// Returns the number of slabs freed.
+static int
+drain(struct kcache *c, struct kmag *m, int n)
+{
+  struct slab *s;
+  void *o;
+  int freed = 0;
+
+  while(n-- > 0 && m->n > 0){
+    o = m->obj[--m->n];
+    s = (struct slab*)PGROUNDDOWN((uint64)o);
+    if(s->free == 0)
+      push_slab(c, s);
+    *(void**)o = s->free;
+    s->free = o;
+    if(--s->inuse == 0){
+      unlink_slab(c, s);
+      kfree(s);
+      freed++;
+    }
+  }
+  return freed;
+}
+
+// Allocate an object from c. Returns 0 if out of memory.
+void *
+kcache_alloc(struct kcache *c)
+{
+  struct kmag *m;
+  void *o = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    refill(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    o = m->obj[--m->n];
+  pop_off();
+  return o;
+}
+
+// Free an object allocated from c.
+void
+kcache_free(struct kcache *c, void *o)
+{
+  struct kmag *m;
+
+  if(((struct slab*)PGROUNDDOWN((uint64)o))->cache != c)
+    panic("kcache_free");
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    drain(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  pop_off();
+}
+
+// Empty this CPU's magazines, freeing the slabs that are left
+// with no objects in use. Returns the number of slabs freed.
+// Interrupts must be disabled.
+static int
+cpudrain(int id)
+{
+  struct kcache *c;
+  int n = 0;
+
+  __atomic_store_n(&drainreq[id], 0, __ATOMIC_SEQ_CST);
+  for(c = kcaches; c; c = c->next){
+    if(c->mag[id].n == 0)
+      continue;
+    acquire(&c->lock);
+    n += drain(c, &c->mag[id], MAGSIZE);
+    release(&c->lock);
+  }
+  return n;
+}
+
+// Give back to kalloc() the slabs that only free objects in
+// magazines keep. This CPU's are freed now. The other CPUs
+// free theirs in scheduler(), so the memory shows up soon
+// after, for a later kalloc() to find; idle ones are woken
+// to do it. Returns the number of pages freed now.
+int
+kcache_reclaim(void)
+{
+  int id, n;
+
+  push_off();
+  id = cpuid();
+  for(int i = 0; i < NCPU; i++){
+    if(i == id || __atomic_exchange_n(&drainreq[i], 1, __ATOMIC_SEQ_CST))
+      continue;
+    if(__atomic_load_n(&cpus[i].idle, __ATOMIC_SEQ_CST))
+      ipi(i);
+  }
+  n = cpudrain(id);
+  pop_off();
+  return n;
+}
+
+// Called by scheduler(): empty this CPU's magazines if
+// kcache_reclaim() asked.
+void
+kcache_cpudrain(void)
+{
+  push_off();
+  if(__atomic_load_n(&drainreq[cpuid()], __ATOMIC_SEQ_CST))
+    cpudrain(cpuid());
+  pop_off();
+}
+
+void
+kmallocinit(void)
+{
+  for(int i = 0; i < NKM; i++)
+    kcache_init(&kmcache[i], kmname[i], KMMIN << i);
+}
+
+// Return the kmalloc() size class for n bytes, or -1
+// if n needs a whole page.
+static int
+kmclass(uint n)
+{
+  int i;
+
+  for(i = 0; i < NKM; i++)
+    if(n <= (KMMIN << i))
+      return i;
+  return -1;
+}
+
+// Allocate n bytes, at most PGSIZE. Returns 0 if out of memory.
+void *
+kmalloc(uint n)
+{
+  int i;
+
+  if(n > PGSIZE)
+    panic("kmalloc");
+  if((i = kmclass(n)) < 0)
+    return kalloc();
+  return kcache_alloc(&kmcache[i]);
+}
+
+// Free p, which kmalloc(n) returned.
+void
+kmfree(void *p, uint n)
+{
+  int i;
+
+  if((i = kmclass(n)) < 0)
+    kfree(p);
+  else
+    kcache_free(&kmcache[i], p);
+}
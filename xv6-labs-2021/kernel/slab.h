@@ -0,0 +1,17 @@
+#define MAGSIZE 16  // free objects each CPU keeps per cache
+
+// A CPU's stash of free objects, see slab.c.
+struct kmag {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+// A cache of objects of one size.
+struct kcache {
+  struct spinlock lock;  // protects partial and the slabs on it
+  char *name;
+  uint size;             // object size, rounded up to 8 bytes
+  struct slab *partial;  // slabs with free objects
+  struct kmag mag[NCPU]; // indexed by cpuid()
+  struct kcache *next;   // in the list of all caches
+};
@@ -1,4 +1,11 @@
 // Sleeping locks
+//
+// Most are held only briefly, e.g. a buffer while another CPU
+// copies a block to or from it, so acquiresleep() first spins
+// for up to SPINTIME while the holder is running on another
+// CPU, rather than pay for a sleep(), a wakeup() and two
+// context switches. It sleeps if the holder is not running,
+// or the wait goes on; disk I/O takes far longer.
 
 #include "types.h"
 #include "riscv.h"
@@ -9,24 +16,55 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+#define SPINTIME (TIMEBASE / 100000)   // 10us, in time CSR ticks
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->owner = 0;
+  lk->nwait = 0;
   lk->pid = 0;
 }
 
+// Is the holder of lk running on some CPU? Reads owner and
+// its state without locks; a wrong guess only costs a spin
+// or a sleep.
+static int
+ownerrunning(struct sleeplock *lk)
+{
+  struct proc *o = __atomic_load_n(&lk->owner, __ATOMIC_RELAXED);
+
+  return o != 0 && o->state == RUNNING;
+}
+
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *p = myproc();
+  uint64 t0 = 0;
+
   acquire(&lk->lk);
   while (lk->locked) {
+    if(ownerrunning(lk) && (t0 == 0 || r_time() - t0 < SPINTIME)){
+      if(t0 == 0)
+        t0 = r_time();
+      release(&lk->lk);
+      while(__atomic_load_n(&lk->locked, __ATOMIC_RELAXED) && ownerrunning(lk) &&
+            r_time() - t0 < SPINTIME)
+        ;
+      acquire(&lk->lk);
+      continue;
+    }
+    lk->nwait++;
     sleep(lk, &lk->lk);
+    lk->nwait--;
   }
   lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->owner = p;
+  lk->pid = p->pid;
   release(&lk->lk);
 }
 
@@ -35,8 +73,10 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  if(lk->nwait)
+    wakeup(lk);
   release(&lk->lk);
 }
 
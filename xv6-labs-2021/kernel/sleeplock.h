@@ -2,9 +2,10 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding lock, for acquiresleep() to spin on
+  int nwait;         // # of processes sleeping for the lock
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
 };
-
@@ -7,13 +7,103 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+// every lock initlock() has set up, for lockstat().
+static struct {
+  struct spinlock lock;
+  struct spinlock *list;
+} locks = { .lock = { .name = "locks" } };
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->queued = 0;
+  lk->qtail = 0;
+  lk->qown = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+
+  acquire(&locks.lock);
+  if((lk->next = locks.list) != 0)
+    lk->next->prev = &lk->next;
+  lk->prev = &locks.list;
+  locks.list = lk;
+  release(&locks.lock);
+}
+
+// Initialize a queued lock: an MCS lock, whose waiters line
+// up in order, each spinning on a node of its own CPU instead
+// of all on lk->locked. Fairer, and cheaper under contention,
+// for hot locks shared by many CPUs; a little dearer without.
+void
+initqlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->queued = 1;
+}
+
+// Wait in lk's queue until the holder hands lk over.
+// Interrupts must be off, so that the node stays this CPU's.
+static void
+qacquire(struct spinlock *lk)
+{
+  struct cpu *c = mycpu();
+  struct qnode *q, *prev;
+  int i;
+
+  for(i = 0; i < NQNODE && (c->qbusy & (1 << i)); i++)
+    ;
+  if(i == NQNODE)
+    panic("acquire: qnodes");
+  c->qbusy |= 1 << i;
+  q = &c->qnode[i];
+  q->next = 0;
+  q->wait = 1;
+
+  // join the tail of the queue; wait if anyone was before us.
+  prev = __atomic_exchange_n(&lk->qtail, q, __ATOMIC_ACQ_REL);
+  if(prev){
+    __sync_fetch_and_add(&lk->nts, 1);
+    __atomic_store_n(&prev->next, q, __ATOMIC_RELEASE);
+    while(__atomic_load_n(&q->wait, __ATOMIC_ACQUIRE))
+      ;
+  }
+  lk->qown = q;
+  lk->locked = 1;
+}
+
+// Hand lk to the next waiter, if any.
+static void
+qrelease(struct spinlock *lk)
+{
+  struct cpu *c = mycpu();
+  struct qnode *q = lk->qown, *next;
+
+  lk->locked = 0;
+  if((next = __atomic_load_n(&q->next, __ATOMIC_ACQUIRE)) == 0){
+    if(__sync_bool_compare_and_swap(&lk->qtail, q, 0))
+      goto done;
+    // a waiter has swapped itself in, but not yet linked.
+    while((next = __atomic_load_n(&q->next, __ATOMIC_ACQUIRE)) == 0)
+      ;
+  }
+  __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+ done:
+  c->qbusy &= ~(1 << (q - c->qnode));
+}
+
+// Forget a lock before freeing the memory that holds it.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&locks.lock);
+  if((*lk->prev = lk->next) != 0)
+    lk->next->prev = lk->prev;
+  release(&locks.lock);
 }
 
 // Acquire the lock.
@@ -29,8 +119,12 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if(lk->queued){
+    qacquire(lk);
+  } else {
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      __sync_fetch_and_add(&lk->nts, 1);
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +134,7 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->n++;
 }
 
 // Release the lock.
@@ -66,7 +161,10 @@ release(struct spinlock *lk)
   // On RISC-V, sync_lock_release turns into an atomic swap:
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  if(lk->queued)
+    qrelease(lk);
+  else
+    __sync_lock_release(&lk->locked);
 
   pop_off();
 }
@@ -108,3 +206,35 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy the counters of up to max locks to the array of
+// struct lockstat at user address addr. Returns the number
+// of locks there are, which may be more than max, or -1.
+int
+lockstat(uint64 addr, int max)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  struct lockstat ls;
+  int n;
+
+  if(max > 0)
+    uvmprefault(addr, (uint64)max * sizeof(ls), 1);
+  acquire(&locks.lock);
+  n = 0;
+  for(lk = locks.list; lk; lk = lk->next){
+    if(n < max){
+      safestrcpy(ls.name, lk->name, sizeof(ls.name));
+      ls.addr = (uint64)lk;
+      ls.nacquire = lk->n;
+      ls.nspin = lk->nts;
+      if(copyout(p->pagetable, addr + n * sizeof(ls), (char*)&ls, sizeof(ls)) < 0){
+        release(&locks.lock);
+        return -1;
+      }
+    }
+    n++;
+  }
+  release(&locks.lock);
+  return n;
+}
@@ -1,9 +1,27 @@
+// A waiter's place in the queue of a queued lock, see initqlock().
+struct qnode {
+  struct qnode *next;  // The next waiter.
+  int wait;            // Spin while set; cleared by the previous holder.
+};
+
+#define NQNODE 8       // queued locks one CPU can hold or wait for at once
+
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  int queued;        // Do waiters queue (MCS) rather than test-and-set?
+  struct qnode *qtail;  // If queued: the last waiter, or the holder.
+  struct qnode *qown;   // If queued: the holder's node.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat():
+  uint64 n;          // # of acquire()s.
+  uint64 nts;        // # of test-and-sets, or waits in the queue,
+                     // that found it held.
+  struct spinlock *next;  // In the list of all locks.
+  struct spinlock **prev;
 };
 
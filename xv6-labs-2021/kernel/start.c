@@ -11,7 +11,7 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][7];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
@@ -64,17 +64,21 @@ timerinit()
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // no timer interrupt until the kernel asks for one: timers
+  // are one-shot, and timerarm() in trap.c programs the next.
+  *(uint64*)CLINT_MTIMECMP(id) = ~0L;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[4] : unused.
+  // scratch[5] : address of CLINT MSIP register, for IPIs.
+  // scratch[6] : set by timervec on a timer interrupt, see devintr().
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
-  scratch[4] = interval;
+  scratch[4] = 0;
+  scratch[5] = CLINT_MSIP(id);
+  scratch[6] = 0;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -83,6 +87,12 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // let supervisor mode read the time CSR, for r_time(),
+  // and user mode too, for nsec() in ulib.c.
+  w_mcounteren(r_mcounteren() | 2);
+  w_scounteren(r_scounteren() | 2);
+
+  // enable machine-mode timer and software interrupts;
+  // the latter are IPIs from ipi().
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -1,13 +1,40 @@
 #include "types.h"
 
+// memset(), memcmp() and memmove() work a 64-bit word at a time
+// between byte-wise heads and tails, whenever the addresses agree
+// mod 8. Misaligned word accesses may trap on RISC-V, so
+// buffers that disagree fall back to bytes.
+#define WSIZE   sizeof(uint64)
+#define WALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  while(n > 0 && !WALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
+  }
+  if(n >= WSIZE){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wdst = (uint64 *) cdst;
+    for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+      wdst[0] = w;
+      wdst[1] = w;
+      wdst[2] = w;
+      wdst[3] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wdst++ = w;
+    cdst = (char *) wdst;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +45,16 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & (WSIZE-1)) == 0){
+    while(n > 0 && !WALIGNED(s1)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the bytes loop finds the difference.
+    while(n >= WSIZE && *(uint64*)s1 == *(uint64*)s2)
+      s1 += WSIZE, s2 += WSIZE, n -= WSIZE;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +69,62 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const uint64 *ws;
+  uint64 *wd;
+  int words;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  words = (((uint64)s ^ (uint64)d) & (WSIZE-1)) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      while(n > 0 && !WALIGNED(d)){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE){
+        ws -= 4, wd -= 4;
+        wd[3] = ws[3];
+        wd[2] = ws[2];
+        wd[1] = ws[1];
+        wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      while(n > 0 && !WALIGNED(d)){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64 *) s;
+      wd = (uint64 *) d;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, ws += 4, wd += 4){
+        wd[0] = ws[0];
+        wd[1] = ws[1];
+        wd[2] = ws[2];
+        wd[3] = ws[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
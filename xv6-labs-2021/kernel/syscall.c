@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "sysstat.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -12,7 +13,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -104,6 +105,28 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_setprio(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_copy_file_range(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_sysstat(void);
+extern uint64 sys_iostat(void);
+extern uint64 sys_clocktime(void);
+extern uint64 sys_wait3(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_waitpid(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,8 +150,78 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_setprio] sys_setprio,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_copy_file_range] sys_copy_file_range,
+[SYS_fsync]   sys_fsync,
+[SYS_lockstat] sys_lockstat,
+[SYS_sysstat] sys_sysstat,
+[SYS_iostat]  sys_iostat,
+[SYS_clocktime] sys_clocktime,
+[SYS_wait3]   sys_wait3,
+[SYS_getrusage] sys_getrusage,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_poll]    sys_poll,
+[SYS_spawn]   sys_spawn,
+[SYS_waitpid] sys_waitpid,
 };
 
+// per-CPU counters for sysstat(), by system call number.
+// the CPU that a call returns on counts it.
+static struct sysstat sysstats[NCPU][NELEM(syscalls)];
+
+// count a call to system call num that took t.
+static void
+syscount(int num, uint64 t)
+{
+  struct sysstat *s;
+  int i;
+
+  push_off();
+  s = &sysstats[cpuid()][num];
+  s->count++;
+  s->time += t;
+  for(i = 0; i < NSYSHIST-1 && (t >> (i+1)) != 0; i++)
+    ;
+  s->hist[i]++;
+  pop_off();
+}
+
+// copy out the counters of system calls 0 .. n-1, summed
+// over the CPUs, to the array of struct sysstat at addr.
+// returns the number of system call numbers there are.
+uint64
+sys_sysstat(void)
+{
+  struct proc *p = myproc();
+  struct sysstat s;
+  uint64 addr;
+  int n, num, c, i;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  for(num = 0; num < n && num < NELEM(syscalls); num++){
+    memset(&s, 0, sizeof(s));
+    for(c = 0; c < NCPU; c++){
+      s.count += sysstats[c][num].count;
+      s.time += sysstats[c][num].time;
+      for(i = 0; i < NSYSHIST; i++)
+        s.hist[i] += sysstats[c][num].hist[i];
+    }
+    if(copyout(p->pagetable, addr + num * sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return NELEM(syscalls);
+}
+
 void
 syscall(void)
 {
@@ -137,7 +230,11 @@ syscall(void)
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    uint64 t0 = r_time();
     p->trapframe->a0 = syscalls[num]();
+    if(p->nfref)
+      argfdput(p);
+    syscount(num, r_time() - t0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
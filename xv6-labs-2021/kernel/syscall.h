@@ -20,3 +20,25 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setprio 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_readv  25
+#define SYS_writev 26
+#define SYS_pread  27
+#define SYS_pwrite 28
+#define SYS_copy_file_range 29
+#define SYS_fsync  30
+#define SYS_lockstat 31
+#define SYS_sysstat 32
+#define SYS_iostat 33
+#define SYS_clocktime 34
+#define SYS_wait3  35
+#define SYS_getrusage 36
+#define SYS_clone  37
+#define SYS_join   38
+#define SYS_futex_wait 39
+#define SYS_futex_wake 40
+#define SYS_poll   41
+#define SYS_spawn  42
+#define SYS_waitpid 43
@@ -15,19 +15,39 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "iostat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// If the process has other threads, one of them might close the
+// descriptor meanwhile, so take a reference to the file, which
+// syscall() drops when the call returns.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct proc *p = myproc();
+  struct mm *m = p->mm;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
     return -1;
+  if(m->ref == 1){
+    if((f = m->ofile[fd]) == 0)
+      return -1;
+  } else {
+    if(p->nfref == NELEM(p->fref))
+      panic("argfd");
+    acquire(&m->lock);
+    if((f = m->ofile[fd]) != 0)
+      p->fref[p->nfref++] = filedup(f);
+    release(&m->lock);
+    if(f == 0)
+      return -1;
+  }
   if(pfd)
     *pfd = fd;
   if(pf)
@@ -35,23 +55,47 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
+// Drop the file references argfd() took for p's
+// system call.
+void
+argfdput(struct proc *p)
+{
+  while(p->nfref > 0)
+    fileclose(p->fref[--p->nfref]);
+}
+
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct mm *m = myproc()->mm;
 
+  acquire(&m->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(m->ofile[fd] == 0){
+      m->ofile[fd] = f;
+      release(&m->lock);
       return fd;
     }
   }
+  release(&m->lock);
   return -1;
 }
 
+// Clear descriptor fd, if it still refers to f.
+static void
+fdclear(int fd, struct file *f)
+{
+  struct mm *m = myproc()->mm;
+
+  acquire(&m->lock);
+  if(m->ofile[fd] == f)
+    m->ofile[fd] = 0;
+  release(&m->lock);
+}
+
 uint64
 sys_dup(void)
 {
@@ -91,6 +135,138 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array of a readv() or writev() call from
+// arguments 1 and 2 into iov. Returns the number of iovecs, or -1.
+static int
+argiov(struct iovec *iov)
+{
+  uint64 uiov;
+  int niov, i;
+  uint64 tot;
+
+  if(argaddr(1, &uiov) < 0 || argint(2, &niov) < 0)
+    return -1;
+  if(niov < 0 || niov > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, niov*sizeof(*iov)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < niov; i++){
+    if(iov[i].iov_len < 0)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  if(tot > 0x7fffffff)
+    return -1;
+  return niov;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || (niov = argiov(iov)) < 0)
+    return -1;
+  return filereadv(f, iov, niov, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || (niov = argiov(iov)) < 0)
+    return -1;
+  return filewritev(f, iov, niov, -1);
+}
+
+// pread() and pwrite() use the offset given instead of the
+// file's own, and leave that unchanged.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// copy_file_range(fdin, fdout, n): copy up to n bytes from
+// fdin's offset to fdout, inside the kernel.
+uint64
+sys_copy_file_range(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+  return filecopy(in, out, n);
+}
+
+// fsync(fd): return once everything written so far, to fd
+// and to every other file, is on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// iostat(st): copy out the disk and buffer cache counters.
+uint64
+sys_iostat(void)
+{
+  struct iostat st;
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  virtio_disk_stat(&st);
+  bstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 uint64
 sys_close(void)
 {
@@ -99,7 +275,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdclear(fd, f);
   fileclose(f);
   return 0;
 }
@@ -185,7 +361,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -215,9 +390,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -336,6 +509,8 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = 0;
+    f->rawin = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -345,6 +520,9 @@ sys_open(void)
     itrunc(ip);
   }
 
+  if(omode & O_EXTENT)
+    iextent(ip);
+
   iunlock(ip);
   end_op();
 
@@ -391,7 +569,7 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
+  struct inode *ip, *old;
   struct proc *p = myproc();
   
   begin_op();
@@ -406,52 +584,99 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&p->mm->lock);
+  old = p->mm->cwd;
+  p->mm->cwd = ip;
+  release(&p->mm->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Each argument string is fetched into a scratch page and then
+// kept in a kmalloc() buffer of its own length, so that a short
+// argv does not hold a page per string.
+// Copy the null-terminated array of strings at user address
+// uargv into argv, in memory from kmalloc(). Returns 0, or -1,
+// in which case argv holds what had been copied so far.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
-  int i;
-  uint64 uargv, uarg;
+  char *buf;
+  int i, n;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
+  if((buf = kalloc()) == 0)
     return -1;
-  }
-  memset(argv, 0, sizeof(argv));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG)
       goto bad;
-    }
-    if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
+    if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0)
       goto bad;
-    }
     if(uarg == 0){
       argv[i] = 0;
       break;
     }
-    argv[i] = kalloc();
-    if(argv[i] == 0)
+    if((n = fetchstr(uarg, buf, PGSIZE)) < 0)
       goto bad;
-    if(fetchstr(uarg, argv[i], PGSIZE) < 0)
+    if((argv[i] = kmalloc(n+1)) == 0)
       goto bad;
+    memmove(argv[i], buf, n+1);
   }
+  kfree(buf);
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  kfree(buf);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+static void
+freeargv(char **argv)
+{
+  int i;
+
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kmfree(argv[i], strlen(argv[i])+1);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int ret;
+  uint64 uargv;
 
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fd[NOFILE], nfd, ret;
+  uint64 uargv, ufd;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufd) < 0 || argint(3, &nfd) < 0)
+    return -1;
+  if(nfd < 0 || nfd > NOFILE)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)fd, ufd, nfd*sizeof(fd[0])) < 0)
+    return -1;
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = spawn(path, argv, fd, nfd);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -469,18 +694,57 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdclear(fd0, rf);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdclear(fd0, rf);
+    fdclear(fd1, wf);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, off;
+  struct file *f;
+
+  // addr is only a hint, and mmap() picks its own.
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// poll(fds, nfds, timeout): wait for any of nfds fds to be
+// ready, for at most timeout ticks unless timeout is -1.
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int nfds, timeout;
+
+  if(argaddr(0, &fds) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return poll(fds, nfds, timeout);
+}
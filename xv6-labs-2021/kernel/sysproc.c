@@ -35,21 +35,79 @@ sys_wait(void)
   uint64 p;
   if(argaddr(0, &p) < 0)
     return -1;
-  return wait(p);
+  return wait(-1, p, 0, 0);
+}
+
+// like wait(), but also return the child's resource usage.
+uint64
+sys_wait3(void)
+{
+  uint64 p, ru;
+  if(argaddr(0, &p) < 0 || argaddr(1, &ru) < 0)
+    return -1;
+  return wait(-1, p, ru, 0);
+}
+
+// waitpid(pid, status, options): wait for child pid, or for
+// any child if pid is -1. with WNOHANG, return 0 rather than
+// wait if it has not exited.
+uint64
+sys_waitpid(void)
+{
+  int pid, options;
+  uint64 p;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &p) < 0 || argint(2, &options) < 0)
+    return -1;
+  if(pid <= 0 && pid != -1)
+    return -1;
+  return wait(pid, p, 0, options);
+}
+
+// clone(fn, arg, stack): start a thread running fn(arg).
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+// join(tid, status): wait for the child thread tid to exit.
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0 || tid <= 0)
+    return -1;
+  return wait(tid, p, 0, 0);
+}
+
+// return the resource usage of this process,
+// or of the children it has waited for.
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 ru;
+
+  if(argint(0, &who) < 0 || argaddr(1, &ru) < 0)
+    return -1;
+  return getrusage(who, ru);
 }
 
 uint64
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
@@ -61,12 +119,14 @@ sys_sleep(void)
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
+  tickupdate();
   ticks0 = ticks;
   while(ticks - ticks0 < n){
     if(myproc()->killed){
       release(&tickslock);
       return -1;
     }
+    tickwait(ticks0 + n);
     sleep(&ticks, &tickslock);
   }
   release(&tickslock);
@@ -91,7 +151,67 @@ sys_uptime(void)
   uint xticks;
 
   acquire(&tickslock);
+  tickupdate();
   xticks = ticks;
   release(&tickslock);
   return xticks;
 }
+
+// return the time since boot in nanoseconds,
+// from the time CSR. nsec() in ulib.c reads the
+// same clock without a system call.
+uint64
+sys_clocktime(void)
+{
+  uint64 t = r_time();
+
+  return t / TIMEBASE * 1000000000L + t % TIMEBASE * (1000000000L / TIMEBASE);
+}
+
+// set the scheduling priority level of a process.
+uint64
+sys_setprio(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setprio(pid, prio);
+}
+
+// copy out the acquire() counts of up to n
+// kernel locks; see spinlock.c.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return lockstat(addr, n);
+}
+
+// futex_wait(addr, val): sleep if *addr is still val.
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+// futex_wake(addr, n): wake up to n sleepers on addr.
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
@@ -0,0 +1,9 @@
+#define NSYSHIST 24   // latency histogram buckets
+
+// One system call's counters, as sysstat() reports them.
+// Times are in ticks of the time CSR (10MHz in qemu).
+struct sysstat {
+  uint64 count;            // # of calls that returned
+  uint64 time;             // total time in them
+  uint64 hist[NSYSHIST];   // hist[i]: # that took [2^i, 2^(i+1)), hist[0] from 0
+};
@@ -0,0 +1,113 @@
+//
+// Kernel event trace.
+// While tracing is on, trace() records timestamped events from
+// the scheduler, sleep and wakeup, traps, the disk driver and the
+// log in a per-CPU ring, overwriting the oldest events when it
+// is full. Each CPU writes only its own ring, with interrupts
+// off, so recording takes no lock.
+// The trace device reads them out: writing "1" to it empties the
+// rings and starts tracing, "0" stops it, and read() then returns
+// whole struct traceevs, each CPU's in order. Reading while
+// tracing is on fails, since the rings are changing.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "trace.h"
+#include "defs.h"
+
+#define NTRACE 2048   // events per CPU
+
+static struct {
+  struct traceev ev[NTRACE];
+  uint w;             // # of events written; the last NTRACE are kept
+  uint r;             // # read
+} tr[NCPU];
+
+static volatile int tracing;
+
+// Record an event of type with arg on this CPU.
+void
+trace(int type, uint64 arg)
+{
+  struct traceev *e;
+  struct cpu *c;
+  int id;
+
+  if(!tracing)
+    return;
+  push_off();
+  id = cpuid();
+  c = mycpu();
+  e = &tr[id].ev[tr[id].w % NTRACE];
+  e->time = r_time();
+  e->type = type;
+  e->cpu = id;
+  e->pid = c->proc ? c->proc->pid : 0;
+  e->arg = arg;
+  tr[id].w++;
+  pop_off();
+}
+
+// user read()s from the trace device go here.
+// copy out as many whole events as fit in n bytes.
+static int
+traceread(int user_dst, uint64 dst, int n)
+{
+  int i, tot;
+
+  if(tracing)
+    return -1;
+  tot = 0;
+  for(i = 0; i < NCPU; i++){
+    if(tr[i].w - tr[i].r > NTRACE)
+      tr[i].r = tr[i].w - NTRACE;    // overwritten
+    while(tr[i].r != tr[i].w && n - tot >= sizeof(struct traceev)){
+      if(either_copyout(user_dst, dst + tot, &tr[i].ev[tr[i].r % NTRACE],
+                        sizeof(struct traceev)) == -1)
+        return tot > 0 ? tot : -1;
+      tr[i].r++;
+      tot += sizeof(struct traceev);
+    }
+  }
+  return tot;
+}
+
+// user write()s to the trace device go here.
+// "1" starts tracing afresh, "0" stops it.
+static int
+tracewrite(int user_src, uint64 src, int n)
+{
+  char c;
+  int i;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) == -1)
+    return -1;
+  if(c == '1'){
+    tracing = 0;
+    for(i = 0; i < NCPU; i++)
+      tr[i].r = tr[i].w = 0;
+    __sync_synchronize();
+    tracing = 1;
+  } else if(c == '0'){
+    tracing = 0;
+    __sync_synchronize();
+  } else {
+    return -1;
+  }
+  return n;
+}
+
+void
+traceinit(void)
+{
+  devsw[TRACE].read = traceread;
+  devsw[TRACE].write = tracewrite;
+}
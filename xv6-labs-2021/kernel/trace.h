@@ -0,0 +1,25 @@
+// Kernel trace events, as read from the trace device.
+#define TR_RUN        1   // scheduler() switches to process arg
+#define TR_DESCHED    2   // scheduler() is back from process arg
+#define TR_SCHED      3   // sched() gives up the CPU, in state arg
+#define TR_SLEEP      4   // sleep() on chan arg
+#define TR_WAKEUP     5   // wakeup() makes process arg runnable
+#define TR_TRAP       6   // usertrap() entered, with scause arg
+#define TR_TRAPRET    7   // usertrapret() returns to user space
+#define TR_DISKSUBMIT 8   // request for block arg, see below
+#define TR_DISKDONE   9   // request for block arg finished
+#define TR_BEGINOP    10  // begin_opn() got log space
+#define TR_ENDOP      11  // end_opn()
+#define TR_COMMIT     12  // log writer starts committing transaction arg
+#define TR_COMMITDONE 13  // and has finished
+#define NTRTYPE       14
+
+// TR_DISKSUBMIT's arg: block number, # of blocks << 32, write << 63.
+
+struct traceev {
+  uint64 time;        // time CSR
+  uint16 type;        // TR_*
+  uint16 cpu;
+  int pid;            // running process, or 0
+  uint64 arg;
+};
@@ -5,11 +5,20 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
-
+#include "trace.h"
+
+// Timers are one-shot. Each CPU's goes off only at its next
+// deadline: the end of the running process's time slice, and
+// on CPU 0 the earliest tick that a sleeper on &ticks waits for.
+// An idle CPU with neither takes no timer interrupts at all.
+// ticks counts TICKTIME periods of the time CSR; clockintr()
+// brings it up to date on any CPU's timer interrupt.
 struct spinlock tickslock;
 uint ticks;
+static uint64 wakeat = ~0L;   // time ticks is next waited for, under tickslock
 
 extern char trampoline[], uservec[], userret[];
+extern uint64 timer_scratch[NCPU][7]; // start.c
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -19,7 +28,7 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initqlock(&tickslock, "time");
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -49,6 +58,8 @@ usertrap(void)
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
+  p->ru[RU_UTIME] += r_time() - p->tuser;
+  trace(TR_TRAP, r_scause());
   
   if(r_scause() == 8){
     // system call
@@ -67,6 +78,22 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    uint64 scause = r_scause(), stval = r_stval();
+
+    // as for a system call. vmfault() may also have to wait
+    // in tlbshootdown() for other CPUs to take its interrupts.
+    intr_on();
+
+    if(vmfault(p->pagetable, stval, p->mm->sz, scause == 15) == 0){
+      // page fault on a lazily allocated, demand-paged or
+      // copy-on-write page, which is now mapped.
+      p->ru[RU_NFAULT]++;
+    } else {
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      p->killed = 1;
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -77,8 +104,10 @@ usertrap(void)
     exit(-1);
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
-    yield();
+  if(which_dev == 2){
+    profsample(p->trapframe->epc, 1);
+    preempt();
+  }
 
   usertrapret();
 }
@@ -91,6 +120,8 @@ usertrapret(void)
 {
   struct proc *p = myproc();
 
+  trace(TR_TRAPRET, 0);
+
   // we're about to switch the destination of traps from
   // kerneltrap() to usertrap(), so turn off interrupts until
   // we're back in user space, where usertrap() is correct.
@@ -100,32 +131,51 @@ usertrapret(void)
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
   // set up trapframe values that uservec will need when
-  // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
-  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
-  p->trapframe->kernel_trap = (uint64)usertrap;
-  p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
+  // the process next re-enters the kernel. only the hartid
+  // changes from one return to the next, unless the trapframe
+  // was just copied from another process's by fork() or clone().
+  struct trapframe *tf = p->trapframe;
+  if(tf->kernel_sp != p->kstack + PGSIZE){
+    tf->kernel_satp = r_satp();         // kernel page table
+    tf->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
+    tf->kernel_trap = (uint64)usertrap;
+  }
+  tf->kernel_hartid = r_tp();           // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
   
-  // set S Previous Privilege mode to User.
+  // set S Previous Privilege mode to User, and enable
+  // interrupts in user mode. after a system call that did
+  // not switch away they are usually still so, and sstatus,
+  // a costly register to write, is left alone.
   unsigned long x = r_sstatus();
-  x &= ~SSTATUS_SPP; // clear SPP to 0 for user mode
-  x |= SSTATUS_SPIE; // enable interrupts in user mode
-  w_sstatus(x);
+  if((x & SSTATUS_SPP) || (x & SSTATUS_SPIE) == 0)
+    w_sstatus((x & ~SSTATUS_SPP) | SSTATUS_SPIE);
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
+  p->tuser = r_time();
+
+  // drop TLB entries this CPU may hold from an older version of
+  // p's page table, or from an earlier process with p's ASID.
+  // trampoline.S doesn't flush the TLB when it switches page
+  // tables, since the kernel and each process have their own ASID.
+  uint64 cpubit = 1L << cpuid();
+  if(asidok && (p->mm->tlbstale & cpubit)){
+    __atomic_fetch_and(&p->mm->tlbstale, ~cpubit, __ATOMIC_SEQ_CST);
+    sfence_vma_asid(p->mm->asid);
+  }
+
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(asidok ? p->mm->asid : 0);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -149,23 +199,82 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  if(which_dev == 2)
+    profsample(sepc, 0);
+
+  // maybe give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    preempt();
 
-  // the yield() may have caused some traps to occur,
+  // the preempt() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to date with the time CSR, and wake the
+// sleepers on &ticks if it moved. Caller must hold tickslock.
+void
+tickupdate(void)
+{
+  uint t = r_time() / TICKTIME;
+
+  if(t != ticks){
+    ticks = t;
+    wakeup(&ticks);
+  }
+}
+
 void
 clockintr()
 {
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  tickupdate();
+  // the sleepers that were due have been woken; those still
+  // waiting call tickwait() again.
+  if(wakeat <= r_time())
+    wakeat = ~0L;
   release(&tickslock);
+  polltick();
+}
+
+// A sleeper on &ticks waits for ticks to reach t: make sure a
+// timer interrupt on CPU 0 brings it there. Caller must hold
+// tickslock, and call again each time it wakes.
+void
+tickwait(uint t)
+{
+  uint64 when = (uint64)t * TICKTIME;
+
+  if(when < wakeat){
+    wakeat = when;
+    if(cpuid() == 0)
+      timerarm();
+    else
+      ipi(0);   // timerarm() on CPU 0, see devintr()
+  }
+}
+
+// Program this CPU's timer for its next deadline.
+// Interrupts must be off.
+void
+timerarm(void)
+{
+  struct cpu *c = mycpu();
+  uint64 when = ~0L;
+
+  if(c->proc)
+    when = c->slicend;
+  if(c == &cpus[0] && wakeat < when)
+    when = wakeat;
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// interrupt CPU id, e.g. to wake it from wfi in scheduler().
+void
+ipi(int id)
+{
+  *(volatile uint32*)CLINT_MSIP(id) = 1;
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -188,7 +297,9 @@ devintr()
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+      virtio_disk_intr(0);
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_disk_intr(1);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -201,18 +312,33 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
+    int timer = __atomic_exchange_n(&timer_scratch[cpuid()][6], 0, __ATOMIC_SEQ_CST);
 
-    if(cpuid() == 0){
+    if(timer){
       clockintr();
+      // a process still running after its slice, since
+      // nothing else wanted the CPU, gets another.
+      if(mycpu()->proc && mycpu()->slicend <= r_time())
+        mycpu()->slicend = r_time() + TICKTIME;
     }
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // another thread of the running process changed its
+    // page table, see tlbshootdown().
+    if(__atomic_exchange_n(&mycpu()->tlbreq, 0, __ATOMIC_SEQ_CST))
+      sfence_vma();
+
+    // the timer is off after it has gone off, and on CPU 0
+    // tickwait() may have asked for an earlier deadline.
+    timerarm();
+
+    // otherwise an IPI only wakes the CPU from wfi in scheduler().
+    return timer ? 2 : 1;
   } else {
     return 0;
   }
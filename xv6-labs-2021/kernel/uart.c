@@ -34,17 +34,26 @@
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
 #define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+                              // (with FIFOs, the whole transmit FIFO is empty)
+#define TX_FIFO_SIZE 16       // 16550a transmit FIFO depth
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 1024
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
 
+// the kernel's own output, from printf() and input echo, also
+// protected by uart_tx_lock. it is sent ahead of uart_tx_buf.
+#define UART_LOG_BUF_SIZE 4096
+char uart_log_buf[UART_LOG_BUF_SIZE];
+uint64 uart_log_w; // write next to uart_log_buf[uart_log_w % UART_LOG_BUF_SIZE]
+uint64 uart_log_r; // read next from uart_log_buf[uart_log_r % UART_LOG_BUF_SIZE]
+
 extern volatile int panicked; // from printf.c
 
 void uartstart();
@@ -108,10 +117,83 @@ uartputc(int c)
   }
 }
 
+// add n characters to the output buffer, as uartputc()
+// does, taking the lock once per bufferful rather than
+// once per character. only suitable for use by write().
+void
+uartputs(char *s, int n)
+{
+  int i = 0;
+
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  while(i < n){
+    if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full.
+      // wait for uartstart() to open up space in the buffer.
+      sleep(&uart_tx_r, &uart_tx_lock);
+      continue;
+    }
+    while(i < n && uart_tx_w < uart_tx_r + UART_TX_BUF_SIZE){
+      uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = s[i++];
+      uart_tx_w += 1;
+    }
+    uartstart();
+  }
+  release(&uart_tx_lock);
+}
+
+// add n characters of kernel output to the log buffer
+// and tell the UART to start sending if it isn't already.
+// never sleeps, so it's safe from interrupts and with
+// locks held; it spins only if the buffer is full.
+void
+uartputs_async(char *s, int n)
+{
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  for(int i = 0; i < n; i++){
+    while(uart_log_w == uart_log_r + UART_LOG_BUF_SIZE){
+      // buffer is full. interrupts are off, so wait
+      // for the UART here rather than for uartintr().
+      while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+        ;
+      uartstart();
+    }
+    uart_log_buf[uart_log_w % UART_LOG_BUF_SIZE] = s[i];
+    uart_log_w += 1;
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// send whatever kernel output is still buffered, spinning
+// on the UART. for panic(), ahead of its own message; it
+// takes no lock, since the lock's holder may never return.
+void
+uartflush_sync(void)
+{
+  while(uart_log_r != uart_log_w){
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    WriteReg(THR, uart_log_buf[uart_log_r % UART_LOG_BUF_SIZE]);
+    uart_log_r += 1;
+  }
+}
+
 // alternate version of uartputc() that doesn't 
-// use interrupts, for use by kernel printf() and
-// to echo characters. it spins waiting for the uart's
-// output register to be empty.
+// use interrupts, for use by panic(). it spins
+// waiting for the uart's output register to be empty.
 void
 uartputc_sync(int c)
 {
@@ -130,34 +212,46 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the log or transmit buffer, send a FIFO's worth.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
+  int c, i;
+  uint64 r = uart_tx_r;
+
   while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
+    if(uart_log_w == uart_log_r && uart_tx_w == uart_tx_r)
+      break;  // both buffers are empty.
     
     if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
+      // the UART transmit FIFO isn't empty yet,
+      // so we don't know how many bytes it can take.
+      // it will interrupt when it's ready for more.
+      break;
     }
     
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
-    uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
+    // the FIFO is empty, so it can take TX_FIFO_SIZE bytes.
+    for(i = 0; i < TX_FIFO_SIZE; i++){
+      if(uart_log_w != uart_log_r){
+        // kernel output first; no one sleeps on it.
+        c = uart_log_buf[uart_log_r % UART_LOG_BUF_SIZE];
+        uart_log_r += 1;
+      } else if(uart_tx_w != uart_tx_r){
+        c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+        uart_tx_r += 1;
+      } else {
+        break;
+      }
+      WriteReg(THR, c);
+    }
   }
+
+  // maybe uartputc() is waiting for space in the buffer.
+  if(uart_tx_r != r)
+    wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
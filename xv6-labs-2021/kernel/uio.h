@@ -0,0 +1,7 @@
+#define MAXIOV 16  // most buffers one readv() or writev() takes
+
+// One user buffer of a readv() or writev().
+struct iovec {
+  void *iov_base;
+  int iov_len;
+};
@@ -27,6 +27,7 @@
 #define VIRTIO_MMIO_INTERRUPT_STATUS	0x060 // read-only
 #define VIRTIO_MMIO_INTERRUPT_ACK	0x064 // write-only
 #define VIRTIO_MMIO_STATUS		0x070 // read/write
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -44,8 +45,21 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two, and small enough that the
+// descriptors and the avail ring fit in the first page.
+#define NUM 64
+
+// most data descriptors (blocks) in one disk request.
+#define NSEG 16
+
+// disks probed, as devices 1..NDISK, and most virtqueues
+// used on each.
+#define NDISK 2
+#define NVQ   4
+
+// offset of num_queues in a disk's configuration, for
+// VIRTIO_BLK_F_MQ.
+#define VIRTIO_BLK_CONFIG_NUMQ 34
 
 // a single descriptor, from the spec.
 struct virtq_desc {
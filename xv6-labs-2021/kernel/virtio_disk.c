@@ -1,9 +1,17 @@
 //
-// driver for qemu's virtio disk device.
+// driver for qemu's virtio disk devices.
 // uses qemu's mmio interface to virtio.
 // qemu presents a "legacy" virtio interface.
 //
-// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0,num-queues=3
+//
+// disk i, at VIRTIO0 + i*0x1000, is device number i+1; the
+// first is required, the others are used if present. a disk
+// that offers VIRTIO_BLK_F_MQ gets up to NVQ virtqueues, and a
+// CPU submits to queue cpuid() % nq, so hart i and hart j
+// contend on the same queue lock only if i = j mod nq. each
+// queue has its own descriptors, rings and lock; the device
+// raises one interrupt for all of them.
 //
 
 #include "types.h"
@@ -16,14 +24,17 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "iostat.h"
+#include "trace.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+// the address of virtio mmio register r of disk d.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
 
-static struct disk {
+// one virtqueue.
+struct vq {
   // the virtio driver and device mostly communicate through a set of
-  // structures in RAM. pages[] allocates that memory. pages[] is a
-  // global (instead of calls to kalloc()) because it must consist of
+  // structures in RAM. pages[] allocates that memory. pages[] is
+  // static (instead of calls to kalloc()) because it must consist of
   // two contiguous pages of page-aligned physical memory.
   char pages[2*PGSIZE];
 
@@ -61,92 +72,168 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[NSEG]; // the request's buffers, consecutive blocks
+    int n;
     char status;
+    uint64 start;        // r_time() at submit
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
   
-  struct spinlock vdisk_lock;
-  
-} __attribute__ ((aligned (PGSIZE))) disk;
+  struct spinlock lock;
+  struct disk *d;
+  int id;          // queue number, for QUEUE_SEL and QUEUE_NOTIFY
 
-void
-virtio_disk_init(void)
+  // statistics, for iostat().
+  struct iostat stat;
+  int ndesc;       // descriptors in use
+  uint64 tlast;    // r_time() when ndesc last changed
+} __attribute__ ((aligned (PGSIZE)));
+
+static struct disk {
+  struct vq q[NVQ];
+  uint64 base;     // mmio registers
+  int nq;          // queues in use; 0 if the disk is absent
+  uint64 tinit;    // r_time() at virtio_disk_init()
+} disk[NDISK];
+
+// set up disk d, at mmio address base. returns -1 if there
+// is no disk there.
+static int
+diskinit(struct disk *d, uint64 base)
 {
   uint32 status = 0;
+  struct vq *q;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  d->base = base;
+  d->tinit = r_time();
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 1 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(d, VIRTIO_MMIO_VERSION) != 1 ||
+     *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    return -1;
   }
   
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
-
-  *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
-
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
-
-  // desc = pages -- num * virtq_desc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
-
-  disk.desc = (struct virtq_desc *) disk.pages;
-  disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
-  disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
-
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
-
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+  *R(d, VIRTIO_MMIO_STATUS) = status;
+
+  *R(d, VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
+
+  d->nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ))
+    d->nq = *(volatile uint16 *)(base + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUMQ);
+  if(d->nq < 1)
+    d->nq = 1;
+  if(d->nq > NVQ)
+    d->nq = NVQ;
+
+  // initialize the queues.
+  for(q = d->q; q < &d->q[d->nq]; q++){
+    initlock(&q->lock, "virtio_disk");
+    q->d = d;
+    q->id = q - d->q;
+    q->tlast = d->tinit;
+
+    *R(d, VIRTIO_MMIO_QUEUE_SEL) = q->id;
+    uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if(max == 0)
+      panic("virtio disk has no queue");
+    if(max < NUM)
+      panic("virtio disk max queue too short");
+    *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+    memset(q->pages, 0, sizeof(q->pages));
+    *R(d, VIRTIO_MMIO_QUEUE_PFN) = ((uint64)q->pages) >> PGSHIFT;
+
+    // desc = pages -- num * virtq_desc
+    // avail = pages + 0x40 -- 2 * uint16, then num * uint16
+    // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+
+    q->desc = (struct virtq_desc *) q->pages;
+    q->avail = (struct virtq_avail *)(q->pages + NUM*sizeof(struct virtq_desc));
+    q->used = (struct virtq_used *) (q->pages + PGSIZE);
+
+    // all NUM descriptors start out unused.
+    for(int i = 0; i < NUM; i++)
+      q->free[i] = 1;
+  }
+  return 0;
+}
+
+void
+virtio_disk_init(void)
+{
+  uint64 base[NDISK] = { VIRTIO0, VIRTIO1 };
+
+  if(diskinit(&disk[0], base[0]) < 0)
+    panic("could not find virtio disk");
+  for(int i = 1; i < NDISK; i++)
+    diskinit(&disk[i], base[i]);
+
+  // plic.c and trap.c arrange for interrupts from VIRTIOn_IRQ.
+}
+
+// the queue this CPU submits requests for device dev to.
+static struct vq *
+getq(uint dev)
+{
+  struct disk *d;
+  int id;
+
+  if(dev < 1 || dev > NDISK || (d = &disk[dev-1])->nq == 0)
+    panic("virtio: no such disk");
+  // the caller may move to another CPU right after, which
+  // costs no more than sharing that CPU's queue for a while.
+  push_off();
+  id = cpuid() % d->nq;
+  pop_off();
+  return &d->q[id];
+}
+
+// account for delta more descriptors in use.
+// caller holds q->lock.
+static void
+inflight(struct vq *q, int delta)
+{
+  uint64 now = r_time();
+
+  q->stat.inflight += q->ndesc * (now - q->tlast);
+  q->tlast = now;
+  q->ndesc += delta;
+  if(q->ndesc > q->stat.maxinflight)
+    q->stat.maxinflight = q->ndesc;
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *q)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -155,28 +242,29 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *q, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
+  wakeup(&q->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
+    inflight(q, -1);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -184,46 +272,68 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(struct vq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// tell the device that q has new requests.
+static void
+notify(struct vq *q)
+{
+  *R(q->d, VIRTIO_MMIO_QUEUE_NOTIFY) = q->id; // value is queue number
+}
+
+// queue one request to read or write the n buffers in bs,
+// which must hold consecutive blocks, without waiting for it
+// to finish. virtio_disk_intr() frees the descriptors.
+// caller holds q->lock and must notify the device.
+static void
+submit(struct vq *q, struct buf **bs, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
+  if(n < 1 || n > NSEG)
+    panic("virtio submit");
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then descriptors for
+  // the data, then one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[NSEG+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(q, idx, n+2) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    // let the device start on what we already queued,
+    // so that its completions free up descriptors.
+    notify(q);
+    sleep(&q->free[0], &q->lock);
+  }
+  inflight(q, n+2);
+  if(write){
+    q->stat.nwrite++;
+    q->stat.wbytes += n*BSIZE;
+  } else {
+    q->stat.nread++;
+    q->stat.rbytes += n*BSIZE;
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -232,84 +342,211 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  q->desc[idx[0]].next = idx[1];
+
+  for(int i = 1; i <= n; i++){
+    struct buf *b = bs[i-1];
+    q->desc[idx[i]].addr = (uint64) b->data;
+    q->desc[idx[i]].len = BSIZE;
+    if(write)
+      q->desc[idx[i]].flags = 0; // device reads b->data
+    else
+      q->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    q->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    q->desc[idx[i]].next = idx[i+1];
+
+    // record struct buf for virtio_disk_intr().
+    b->disk = 1;
+    b->queue = q->id;
+    q->info[idx[0]].b[i-1] = b;
+  }
+  q->info[idx[0]].n = n;
+  q->info[idx[0]].start = r_time();
+  trace(TR_DISKSUBMIT, bs[0]->blockno | (uint64)n << 32 | (uint64)write << 63);
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  q->info[idx[0]].status = 0xff; // device writes 0 on success
+  q->desc[idx[n+1]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[n+1]].len = 1;
+  q->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  q->desc[idx[n+1]].next = 0;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  q->avail->ring[q->avail->idx % NUM] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  q->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// queue requests for the n buffers in bs, all of one disk,
+// merging each run of consecutive blocks into a single request.
+// caller holds q->lock and must notify the device.
+static void
+submitv(struct vq *q, struct buf **bs, int n, int write)
+{
+  int i, j;
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  for(i = 0; i < n; i = j){
+    for(j = i+1; j < n && j-i < NSEG; j++){
+      if(bs[j]->blockno != bs[i]->blockno + (j-i))
+        break;
+    }
+    submit(q, bs+i, j-i, write);
   }
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
+}
 
-  release(&disk.vdisk_lock);
+// start reading or writing the n buffers in bs and
+// return without waiting. each buffer's b->disk stays 1
+// until its request finishes; then virtio_disk_intr()
+// clears it and calls b->iodone, if set. the buffers of
+// each disk go to this CPU's queue on that disk.
+void
+virtio_disk_submit(struct buf **bs, int n, int write)
+{
+  struct vq *q;
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    for(j = i+1; j < n && bs[j]->dev == bs[i]->dev; j++)
+      ;
+    q = getq(bs[i]->dev);
+    acquire(&q->lock);
+    submitv(q, bs+i, j-i, write);
+    notify(q);
+    release(&q->lock);
+  }
 }
 
+// wait for a request started by virtio_disk_submit() to finish.
 void
-virtio_disk_intr()
+virtio_disk_wait(struct buf *b)
 {
-  acquire(&disk.vdisk_lock);
+  struct vq *q = &disk[b->dev-1].q[b->queue];
 
-  // the device won't raise another interrupt until we tell it
-  // we've seen this interrupt, which the following line does.
-  // this may race with the device writing new entries to
-  // the "used" ring, in which case we may process the new
-  // completion entries in this interrupt, and have nothing to do
-  // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  acquire(&q->lock);
+  while(b->disk == 1) {
+    sleep(b, &q->lock);
+  }
+  release(&q->lock);
+}
 
-  __sync_synchronize();
+// read or write n buffers, keeping as many of them
+// in flight at once as the descriptors allow, and
+// return once all have finished.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  virtio_disk_submit(bs, n, write);
+
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(int i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
 
-  // the device increments disk.used->idx when it
+// finish the requests the device has completed on q.
+static void
+vqintr(struct vq *q)
+{
+  acquire(&q->lock);
+
+  // the device increments q->used->idx when it
   // adds an entry to the used ring.
 
-  while(disk.used_idx != disk.used->idx){
+  while(q->used_idx != q->used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = q->used->ring[q->used_idx % NUM].id;
 
-    if(disk.info[id].status != 0)
+    if(q->info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    trace(TR_DISKDONE, q->info[id].b[0]->blockno);
+    uint64 t = r_time() - q->info[id].start;
+    q->stat.svctime += t;
+    if(t > q->stat.maxsvctime)
+      q->stat.maxsvctime = t;
+
+    free_chain(q, id);
+    for(int i = 0; i < q->info[id].n; i++){
+      struct buf *b = q->info[id].b[i];
+      q->info[id].b[i] = 0;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+
+      // the callback runs with q->lock held, in interrupt
+      // context, so it must not sleep or start more disk I/O.
+      void (*iodone)(struct buf *) = b->iodone;
+      if(iodone){
+        b->iodone = 0;
+        iodone(b);
+      }
+    }
 
-    disk.used_idx += 1;
+    q->used_idx += 1;
   }
 
-  release(&disk.vdisk_lock);
+  release(&q->lock);
+}
+
+// interrupt from disk n.
+void
+virtio_disk_intr(int n)
+{
+  struct disk *d = &disk[n];
+
+  if(d->nq == 0)
+    return;
+
+  // the device won't raise another interrupt until we tell it
+  // we've seen this interrupt, which the following line does.
+  // this may race with the device writing new entries to
+  // the "used" rings, in which case we may process the new
+  // completion entries in this interrupt, and have nothing to do
+  // in the next interrupt, which is harmless.
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+
+  __sync_synchronize();
+
+  // the interrupt does not say which queue is done.
+  for(struct vq *q = d->q; q < &d->q[d->nq]; q++)
+    vqintr(q);
+}
+
+// copy the counters of all disks and queues, summed, to *st.
+// maxinflight is the sum of each queue's most.
+void
+virtio_disk_stat(struct iostat *st)
+{
+  struct disk *d;
+  struct vq *q;
+
+  memset(st, 0, sizeof(*st));
+  for(d = disk; d < &disk[NDISK]; d++){
+    for(q = d->q; q < &d->q[d->nq]; q++){
+      acquire(&q->lock);
+      inflight(q, 0);
+      st->nread += q->stat.nread;
+      st->nwrite += q->stat.nwrite;
+      st->rbytes += q->stat.rbytes;
+      st->wbytes += q->stat.wbytes;
+      st->svctime += q->stat.svctime;
+      if(q->stat.maxsvctime > st->maxsvctime)
+        st->maxsvctime = q->stat.maxsvctime;
+      st->maxinflight += q->stat.maxinflight;
+      st->inflight += q->stat.inflight;
+      release(&q->lock);
+    }
+  }
+  st->elapsed = r_time() - disk[0].tinit;
 }
@@ -5,16 +5,32 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// does the MMU implement enough ASID bits for one per process?
+// if not, usertrapret() flushes the whole TLB every time.
+int asidok;
+
+// a page of zeros, mapped copy-on-write wherever a process loads
+// from lazily allocated memory it has not stored to, see vmfault().
+// kvminit() keeps a reference to it, so it is never freed.
+static char *zeropage;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static int mapsuper(pagetable_t, uint64, uint64, int);
+
+#define NBATCH 64  // pages uvmalloc() and uvmunmap() get from or give to kalloc at once
+static void tlbflush(pagetable_t, uint64);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -27,8 +43,13 @@ kvmmake(void)
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
-  // virtio mmio disk interface
+  // CLINT software interrupt registers, for IPIs, and
+  // timer compare registers, for timerarm().
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
+  // virtio mmio disk interfaces
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -54,6 +75,8 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zeropage");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -61,10 +84,70 @@ kvminit(void)
 void
 kvminithart()
 {
+  // probe how many ASID bits the MMU implements:
+  // satp ignores writes to the others.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(0xffff));
+  asidok = ((r_satp() >> 44) & 0xffff) >= NPROC;
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// The PTE for va in pagetable has just changed. If pagetable
+// belongs to the running process, flush its TLB entry for va
+// on this CPU. Any other CPU may also hold stale entries for
+// the process; they flush all of them before the process next
+// runs there, see usertrapret(). A CPU running another thread
+// of the process right now is only told by tlbshootdown().
+static void
+tlbflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  push_off();
+  sfence_vma_page(va, p->mm->asid);
+  __atomic_fetch_or(&p->mm->tlbstale, ~(1L << cpuid()), __ATOMIC_SEQ_CST);
+  pop_off();
+}
+
+// pagetable, of the running process, has just lost a mapping or
+// a permission. Make the other CPUs now running threads of the
+// process flush their TLBs, and wait until they have, so that
+// the caller can free or reuse the pages involved. A caller
+// with interrupts off, as when holding a spinlock, cannot wait
+// for the interrupts and only sends them. Until they land,
+// other CPUs may still use the old mappings: after a COW break
+// in such a caller, as in a copyout() under a pipe's lock, other
+// threads may briefly read the old copy of a page that this
+// one has already stored to. Callers must not free a page in
+// that state; cowfault() only drops its reference.
+void
+tlbshootdown(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int wait, me;
+
+  if(p == 0 || p->pagetable != pagetable || p->mm->ref == 1)
+    return;
+  push_off();
+  me = cpuid();
+  wait = mycpu()->noff == 1 && (mycpu()->intena);
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c - cpus == me || c->proc == 0 || c->proc->pagetable != pagetable)
+      continue;
+    __atomic_store_n(&c->tlbreq, 1, __ATOMIC_SEQ_CST);
+    ipi(c - cpus);
+  }
+  pop_off();
+  if(!wait)
+    return;
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    while(__atomic_load_n(&c->tlbreq, __ATOMIC_SEQ_CST))
+      ;
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -77,6 +160,9 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a 2MB superpage (only the kernel uses them,
+// see kvmmap()), return the level-1 PTE that maps it.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -85,13 +171,21 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
 
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
+    if(PTE_LEAF(*pte)) {
+      return pte;
+    } else if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      pagetable_t new;
+      if(!alloc || (new = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
+      // threads sharing the page table may race to fill *pte.
+      if(__sync_bool_compare_and_swap(pte, 0, PA2PTE(new) | PTE_V)){
+        pagetable = new;
+      } else {
+        kfree(new);
+        pagetable = (pagetable_t)PTE2PA(*pte);
+      }
     }
   }
   return &pagetable[PX(0, va)];
@@ -126,8 +220,56 @@ walkaddr(pagetable_t pagetable, uint64 va)
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+
+  // use 2MB superpages for the parts of the range where
+  // va and pa are both 2MB-aligned, 4KB pages elsewhere.
+  // this makes far fewer PTEs and TLB entries for the
+  // direct map of RAM.
+  while(sz > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && sz >= SUPERPGSIZE){
+      if(mapsuper(kpgtbl, va, pa, perm) != 0)
+        panic("kvmmap");
+      n = SUPERPGSIZE;
+    } else {
+      n = SUPERPGSIZE - va % SUPERPGSIZE;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
+}
+
+// Create a 2MB superpage mapping of va to pa, both of
+// which must be 2MB-aligned, with a level-1 leaf PTE.
+// Returns 0 on success, -1 if walk() couldn't
+// allocate a needed page-table page.
+static int
+mapsuper(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+  pagetable_t l1;
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V) {
+    if(PTE_LEAF(*pte))
+      panic("mapsuper: remap");
+    l1 = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((l1 = (pde_t*)kalloc()) == 0)
+      return -1;
+    memset(l1, 0, PGSIZE);
+    *pte = PA2PTE(l1) | PTE_V;
+  }
+  pte = &l1[PX(1, va)];
+  if(*pte & PTE_V)
+    panic("mapsuper: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -160,30 +302,53 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never touched (see vmfault())
+// have no mapping and are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, last;
   pte_t *pte;
+  void *pa[NBATCH];
+  int n;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+  n = 0;
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; ){
+    // clear the PTEs of one leaf page-table page at a time.
+    last = a - a % SUPERPGSIZE + SUPERPGSIZE;
+    if(last > end)
+      last = end;
+    if((pte = walk(pagetable, a, 0)) == 0){
+      a = last;   // no leaf page-table page, so nothing mapped
+      continue;
+    }
+    for(; a < last; a += PGSIZE, pte++){
+      if((*pte & PTE_V) == 0)
+        continue;
+      if(PTE_FLAGS(*pte) == PTE_V)
+        panic("uvmunmap: not a leaf");
+      if(do_free)
+        pa[n++] = (void*)PTE2PA(*pte);
+      *pte = 0;
+      tlbflush(pagetable, a);
+      if(n == NBATCH){
+        // no CPU may still reach a page through its TLB
+        // once the page is free.
+        tlbshootdown(pagetable);
+        kfreen(pa, n);
+        n = 0;
+      }
     }
-    *pte = 0;
   }
+  if(do_free)
+    tlbshootdown(pagetable);
+  if(n > 0)
+    kfreen(pa, n);
 }
 
 // create an empty user page table.
@@ -192,10 +357,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -220,22 +384,34 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
-  char *mem;
+  void *mem[NBATCH];
   uint64 a;
+  pte_t *pte;
+  int i, n, want;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
-    if(mem == 0){
+  for(a = oldsz; a < newsz; ){
+    // fill the PTEs of one leaf page-table page at a time,
+    // with pages from kalloc in batches.
+    if((pte = walk(pagetable, a, 1)) == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
-      kfree(mem);
+    want = (PGROUNDUP(newsz) - a) / PGSIZE;
+    if(want > 512 - PX(0, a))
+      want = 512 - PX(0, a);
+    if(want > NBATCH)
+      want = NBATCH;
+    n = kallocn_zeroed(mem, want);
+    for(i = 0; i < n; i++, a += PGSIZE, pte++){
+      if(*pte & PTE_V)
+        panic("uvmalloc: remap");
+      *pte = PA2PTE(mem[i]) | PTE_W|PTE_X|PTE_R|PTE_U|PTE_V;
+    }
+    if(n < want){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
@@ -293,40 +469,299 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: parent and child share the
+// physical pages, with writable pages made read-only and
+// marked PTE_COW in both. A later store to such a page
+// faults, and uvmcowfault() gives the writer its own copy.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmshare(old, new, 0, sz, 1);
+}
+
+// Copy the mappings of user addresses [va, end) from old to new,
+// as uvmcopy() does. If cow is 0, writable pages stay writable in
+// both, so that a MAP_SHARED mapping really is shared.
+// returns 0 on success, -1 on failure.
+// frees any allocated pages on failure.
+int
+uvmshare(pagetable_t old, pagetable_t new, uint64 va, uint64 end, int cow)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = va; i < end; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;   // not yet touched; the child faults it in itself.
+    if(cow && (*pte & PTE_W)){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      tlbflush(old, i);
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kdup((void*)pa);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
+// Map the user page at va to pa with perm, unless another thread
+// sharing pagetable already has; then free pa. Returns 0, or -1
+// if out of memory.
+int
+uvminstall(pagetable_t pagetable, uint64 va, void *pa, int perm)
+{
+  pte_t *pte;
+
+  if((pte = walk(pagetable, va, 1)) == 0){
+    kfree(pa);
+    return -1;
+  }
+  if(!__sync_bool_compare_and_swap(pte, 0, PA2PTE(pa) | perm | PTE_V))
+    kfree(pa);
+  return 0;
+}
+
+// Handle a store to the copy-on-write user page containing va.
+// Gives pagetable a private, writable copy of the page, or just
+// makes it writable if no other page table still shares it.
+// Returns 0 on success, -1 if va is not a COW page or if
+// memory is exhausted.
+static int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcnt((void*)pa) == 1){
+    // no one else shares the page any more.
+    __sync_bool_compare_and_swap(pte, PA2PTE(pa) | PTE_FLAGS(*pte), PA2PTE(pa) | flags);
+  } else {
+    if(pa == (uint64)zeropage){
+      // nothing to copy.
+      if((mem = kalloc_zeroed()) == 0)
+        return -1;
+    } else {
+      if((mem = kalloc()) == 0)
+        return -1;
+      memmove(mem, (char*)pa, PGSIZE);
+    }
+    // another thread may have got there first.
+    if(!__sync_bool_compare_and_swap(pte, PA2PTE(pa) | (flags & ~PTE_W) | PTE_COW,
+                                     PA2PTE(mem) | flags)){
+      kfree(mem);
+      tlbflush(pagetable, va);
+      return 0;
+    }
+    tlbflush(pagetable, va);
+    tlbshootdown(pagetable);
+    kfree((void*)pa);
+    return 0;
+  }
+  tlbflush(pagetable, va);
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in a process
+// of size sz. sbrk() only grows p->mm->sz, so a page below sz with
+// no mapping is backed here, on first touch, by a page of the
+// program file (see execfault()) or else by a zeroed page: its
+// own for a store, the shared zeropage, copy-on-write, for a load.
+// A page above sz may belong to a mapped file, see mmapfault().
+// A store (write != 0) to a copy-on-write page gets its own copy.
+// Returns 0 if the faulting access can now be retried, or -1 if
+// it was a real fault or memory is exhausted.
+int
+vmfault(pagetable_t pagetable, uint64 va, uint64 sz, int write)
+{
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW)){
+      // pages of read-only private mappings are copy-on-write
+      // too, see mmapfault().
+      if(va >= sz){
+        struct proc *p = myproc();
+        if(p == 0 || p->pagetable != pagetable || !mmapwritable(p, va))
+          return -1;
+      }
+      return cowfault(pagetable, va);
+    }
+    // another thread mapped the page after this CPU's TLB
+    // cached it as invalid.
+    if((*pte & PTE_U) && (*pte & (write ? PTE_W : PTE_R))){
+      tlbflush(pagetable, va);
+      return 0;
+    }
+    return -1;
+  }
+
+  if(va >= sz){
+    struct proc *p = myproc();
+    if(p == 0 || p->pagetable != pagetable || mmapfault(p, va, write) < 0)
+      return -1;
+    tlbflush(pagetable, va);
+    return 0;
+  }
+
+  // a page of the program, not yet read from the executable?
+  struct proc *p = myproc();
+  if(p && p->pagetable == pagetable){
+    int r = execfault(p, va);
+    if(r < 0)
+      return -1;
+    if(r > 0){
+      tlbflush(pagetable, va);
+      return 0;
+    }
+  }
+
+  // lazily allocated page. memory that is only ever read, such
+  // as much of a large sparse array, then takes no pages.
+  if(write){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    perm = PTE_W|PTE_X|PTE_R|PTE_U;
+  } else {
+    mem = zeropage;
+    kdup(mem);
+    perm = PTE_X|PTE_R|PTE_U|PTE_COW;
+  }
+  if(p && p->pagetable == pagetable && p->mm->ref > 1){
+    // another thread may have shrunk the process meanwhile;
+    // growproc() lowers sz under the lock before it unmaps.
+    acquire(&p->mm->lock);
+    if(va >= p->mm->sz){
+      release(&p->mm->lock);
+      kfree(mem);
+      return -1;
+    }
+    if(uvminstall(pagetable, va, mem, perm) != 0){
+      release(&p->mm->lock);
+      return -1;
+    }
+    release(&p->mm->lock);
+  } else if(uvminstall(pagetable, va, mem, perm) != 0){
+    return -1;
+  }
+  tlbflush(pagetable, va);
+  return 0;
+}
+
+// A cursor for the user pages that copyin(), copyout() and
+// copyinstr() touch one after another. It remembers the leaf
+// page-table page of the last lookup, so that only the first
+// page in each 2MB region costs a walk(). Page-table pages are
+// not freed until the whole page table is, so the leaf stays
+// valid. User page tables have no superpages.
+struct uvmcursor {
+  pagetable_t pagetable;
+  uint64 base;     // first va mapped by leaf
+  pte_t *leaf;     // level-0 page-table page, or 0
+};
+
+// Return the PTE for user va, or 0 if there is no leaf
+// page-table page for it.
+static pte_t *
+uvmlookup(struct uvmcursor *c, uint64 va)
+{
+  pte_t *pte;
+
+  if(c->leaf && va - c->base < SUPERPGSIZE)
+    return &c->leaf[PX(0, va)];
+  if((pte = walk(c->pagetable, va, 0)) == 0){
+    c->leaf = 0;
+    return 0;
+  }
+  c->leaf = pte - PX(0, va);
+  c->base = va - va % SUPERPGSIZE;
+  return pte;
+}
+
+// Look up user virtual address va for a kernel copy to
+// (write != 0) or from user memory. If the page table belongs to
+// the current process, first take care of what a user access
+// would have faulted on: lazily allocated and copy-on-write pages.
+// Returns the physical address of the page, or 0.
+static uint64
+uvmresolve(struct uvmcursor *c, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = uvmlookup(c, va);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW))){
+    if(p == 0 || p->pagetable != c->pagetable)
+      return 0;
+    if(vmfault(c->pagetable, va, p->mm->sz, write) < 0)
+      return 0;
+    p->ru[RU_NFAULT]++;
+    pte = uvmlookup(c, va);
+  }
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  // a store to a read-only page, such as one of a read-only
+  // mapping, faults for the user, and must fail here too.
+  if(write && (*pte & PTE_W) == 0)
+    return 0;
+  if(write)
+    *pte |= PTE_D;   // as a user store would, see mmap.c
+  return PTE2PA(*pte);
+}
+
+// Fault in the pages of [va, va+len) of the current process
+// that would have to be read from a file, as copyout() (write)
+// or copyin() would, for a caller about to copy while holding
+// a spinlock, under which such a read cannot sleep. Errors are
+// left for the copy to find.
+void
+uvmprefault(uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  struct uvmcursor c = { p->pagetable, 0, 0 };
+  pte_t *pte;
+  uint64 a;
+
+  if(va + len < va || va + len > MAXVA)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = uvmlookup(&c, a);
+    if(pte && (*pte & PTE_V))
+      continue;
+    if((a >= p->mm->sz || execpage(p, a)) &&
+       vmfault(p->pagetable, a, p->mm->sz, write) == 0)
+      p->ru[RU_NFAULT]++;
+  }
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -338,6 +773,7 @@ uvmclear(pagetable_t pagetable, uint64 va)
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  tlbflush(pagetable, va);
 }
 
 // Copy from kernel to user.
@@ -347,10 +783,11 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct uvmcursor c = { pagetable, 0, 0 };
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmresolve(&c, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -372,10 +809,11 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct uvmcursor c = { pagetable, 0, 0 };
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmresolve(&c, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -390,6 +828,20 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Return the physical address of user virtual address va, as
+// a store would find it, so that after a fork() it is this
+// process's own copy. Returns 0 if va is not writable.
+uint64
+uvmpa(pagetable_t pagetable, uint64 va)
+{
+  struct uvmcursor c = { pagetable, 0, 0 };
+  uint64 pa;
+
+  if((pa = uvmresolve(&c, PGROUNDDOWN(va), 1)) == 0)
+    return 0;
+  return pa + va % PGSIZE;
+}
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -398,11 +850,12 @@ int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
+  struct uvmcursor c = { pagetable, 0, 0 };
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmresolve(&c, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
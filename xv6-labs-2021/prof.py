@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+#
+# Turn the output of xv6's prof program, saved from the console,
+# into a flat profile by function, using kernel/kernel.sym and
+# the user/<name>.sym files the Makefile writes.
+#
+#   python3 prof.py prof.out
+#
+
+import bisect
+import os
+import sys
+
+def load(path):
+    syms = []
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            # skip file names, sections and local labels.
+            if len(fields) != 2 or '.' in fields[1]:
+                continue
+            syms.append((int(fields[0], 16), fields[1]))
+    syms.sort()
+    return [a for a, _ in syms], [n for _, n in syms]
+
+tables = {}
+
+def lookup(path, pc):
+    if path not in tables:
+        tables[path] = load(path) if os.path.exists(path) else ([], [])
+    addrs, names = tables[path]
+    i = bisect.bisect_right(addrs, pc) - 1
+    return names[i] if i >= 0 else '?'
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: prof.py prof.out")
+    funcs = {}
+    total = 0
+    with open(sys.argv[1]) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 3 and fields[1] == 'k':
+                name = 'kernel:' + lookup('kernel/kernel.sym', int(fields[2], 16))
+            elif len(fields) == 4 and fields[1] == 'u':
+                prog = fields[2]
+                name = prog + ':' + lookup('user/%s.sym' % prog, int(fields[3], 16))
+            else:
+                continue
+            funcs[name] = funcs.get(name, 0) + int(fields[0])
+            total += int(fields[0])
+    for name, n in sorted(funcs.items(), key=lambda x: -x[1]):
+        print('%6.2f%% %6d  %s' % (100.0 * n / total, n, name))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+#
+# Turn the output of xv6's trace program, saved from the console,
+# into Chrome trace-event JSON, for chrome://tracing or
+# https://ui.perfetto.dev:
+#
+#   python3 trace.py trace.out > trace.json
+#
+# The "cpus" track group shows which process each CPU runs; the
+# "processes" group shows each process's traps and file system
+# operations, with its sleeps and wakeups; the "disk" group
+# shows disk requests from submit to completion.
+#
+
+import json
+import sys
+
+TIMEBASE = 10000000   # time CSR ticks per second, as kernel/memlayout.h
+
+CPUS, PROCS, DISK = 0, 1, 2
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: trace.py trace.out")
+    evs = []
+    for line in open(sys.argv[1]):
+        f = line.split()
+        if len(f) != 6 or f[0] != "ev":
+            continue
+        evs.append((int(f[1]), int(f[2]), int(f[3]), f[4], int(f[5], 16)))
+    evs.sort()
+
+    out = []
+    def add(ph, name, ts, pid, tid, **kw):
+        e = {"ph": ph, "name": name, "ts": ts, "pid": pid, "tid": tid}
+        e.update(kw)
+        out.append(e)
+
+    for g, name in ((CPUS, "cpus"), (PROCS, "processes"), (DISK, "disk")):
+        add("M", "process_name", 0, g, 0, args={"name": name})
+
+    intrap = set()    # processes inside a trap, to drop unmatched ends
+    inop = {}         # process -> depth of file system operations
+    reqs = {}         # block -> name of its disk request
+    t0 = evs[0][0] if evs else 0
+    for t, cpu, pid, typ, arg in evs:
+        ts = (t - t0) * 1000000.0 / TIMEBASE
+        if typ == "run":
+            add("B", "pid %d" % arg, ts, CPUS, cpu)
+        elif typ == "desched":
+            add("E", "pid %d" % arg, ts, CPUS, cpu)
+        elif typ == "trap":
+            add("B", "syscall" if arg == 8 else "trap %d" % arg, ts, PROCS, pid)
+            intrap.add(pid)
+        elif typ == "trapret":
+            if pid in intrap:
+                add("E", "trap", ts, PROCS, pid)
+                intrap.discard(pid)
+        elif typ == "beginop":
+            add("B", "fs op", ts, PROCS, pid)
+            inop[pid] = inop.get(pid, 0) + 1
+        elif typ == "endop":
+            if inop.get(pid, 0) > 0:
+                add("E", "fs op", ts, PROCS, pid)
+                inop[pid] -= 1
+        elif typ == "commit":
+            add("B", "commit %d" % arg, ts, PROCS, pid)
+        elif typ == "commitdone":
+            add("E", "commit %d" % arg, ts, PROCS, pid)
+        elif typ == "sleep":
+            add("i", "sleep", ts, PROCS, pid, s="t", args={"chan": hex(arg)})
+        elif typ == "wakeup":
+            add("i", "wakeup %d" % arg, ts, PROCS, pid, s="t", args={"pid": arg})
+        elif typ == "disksubmit":
+            block = arg & 0xffffffff
+            n = (arg >> 32) & 0x7fffffff
+            op = "write" if arg >> 63 else "read"
+            reqs[block] = "%s %d+%d" % (op, block, n)
+            add("b", reqs[block], ts, DISK, 0, id=block, cat="disk")
+        elif typ == "diskdone":
+            if arg in reqs:
+                add("e", reqs.pop(arg), ts, DISK, 0, id=arg, cat="disk")
+    json.dump({"traceEvents": out, "displayTimeUnit": "us"}, sys.stdout)
+
+if __name__ == "__main__":
+    main()
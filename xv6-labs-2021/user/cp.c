@@ -0,0 +1,66 @@
+// cp [-u] [-t] src dst
+//
+// Copies src to dst with copy_file_range(), so the data never
+// passes through user memory. -u copies with read() and write()
+// through a user buffer instead, for comparison; -t reports the
+// bytes copied and the ticks taken.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char buf[4096];
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd0, fd1, n, tot, user, timed, t0;
+
+  user = timed = 0;
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-u") == 0)
+      user = 1;
+    else if(strcmp(argv[i], "-t") == 0)
+      timed = 1;
+    else
+      break;
+  }
+  if(argc - i != 2){
+    fprintf(2, "usage: cp [-u] [-t] src dst\n");
+    exit(1);
+  }
+
+  if((fd0 = open(argv[i], O_RDONLY)) < 0){
+    fprintf(2, "cp: cannot open %s\n", argv[i]);
+    exit(1);
+  }
+  if((fd1 = open(argv[i+1], O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "cp: cannot create %s\n", argv[i+1]);
+    exit(1);
+  }
+
+  t0 = uptime();
+  tot = 0;
+  for(;;){
+    if(user){
+      if((n = read(fd0, buf, sizeof(buf))) > 0 && write(fd1, buf, n) != n)
+        n = -1;
+    } else {
+      n = copy_file_range(fd0, fd1, 64*1024);
+    }
+    if(n <= 0)
+      break;
+    tot += n;
+  }
+  if(n < 0){
+    fprintf(2, "cp: error copying %s to %s\n", argv[i], argv[i+1]);
+    exit(1);
+  }
+  if(timed)
+    printf("%d bytes in %d ticks\n", tot, uptime() - t0);
+
+  close(fd0);
+  close(fd1);
+  exit(0);
+}
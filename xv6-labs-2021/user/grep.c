@@ -1,36 +1,253 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern is a sequence of atoms, each a character or '.',
+// and each maybe followed by '*'. Its positions 0..n (n meaning
+// "matched") form an NFA, which grep turns into a DFA lazily:
+// each DFA state is a set of positions, and a transition is
+// computed the first time the input needs it and then looked
+// up, so the scan costs one table lookup per byte, with no
+// backtracking. The state cache holds NSTATE sets and starts
+// over when full. Patterns of more than MAXATOM atoms use the
+// Kernighan & Pike matcher below instead.
+//
+// Input is read in large chunks, and matching lines are
+// collected in an output buffer, so that grep makes few
+// system calls.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
+#define MAXATOM 63      // positions must fit in a uint64
+#define NSTATE  64      // DFA states cached
+#define ANY     256     // atom that is '.'
+
+char buf[64*1024];
+char obuf[8*1024];
+int obufn;
+
 int match(char*, char*);
 
+// the compiled pattern.
+struct {
+  int n;                // number of atoms
+  int c[MAXATOM];       // character, or ANY
+  uint64 star;          // atoms followed by '*'
+  int bol;              // starts with '^'
+  int eol;              // ends with '$'
+} re;
+
+// the DFA.
+struct {
+  int n;                // states in use
+  uint64 set[NSTATE];   // positions of each state
+  short next[NSTATE][256];  // next state on each byte, or -1
+  int start;            // state before the first byte of a line
+} dfa;
+
+// Compile pattern into re. Returns -1 if it has too many atoms.
+int
+compile(char *pattern)
+{
+  char *p = pattern;
+
+  re.n = 0;
+  re.star = 0;
+  re.bol = re.eol = 0;
+  if(*p == '^'){
+    re.bol = 1;
+    p++;
+  }
+  while(*p){
+    if(p[0] == '$' && p[1] == '\0'){
+      re.eol = 1;
+      break;
+    }
+    if(re.n == MAXATOM)
+      return -1;
+    re.c[re.n] = p[0] == '.' ? ANY : (uchar)p[0];
+    if(p[1] == '*'){
+      re.star |= 1ULL << re.n;
+      p += 2;
+    } else {
+      p++;
+    }
+    re.n++;
+  }
+  return 0;
+}
+
+// Add to s the positions reachable from it by skipping
+// starred atoms.
+uint64
+closure(uint64 s)
+{
+  int i;
+
+  for(i = 0; i < re.n; i++)
+    if((s & (1ULL << i)) && (re.star & (1ULL << i)))
+      s |= 1ULL << (i+1);
+  return s;
+}
+
+// Return the DFA state for position set s, adding it if need be.
+// Returns -1 if the cache is full.
+int
+state(uint64 s)
+{
+  int i;
+
+  for(i = 0; i < dfa.n; i++)
+    if(dfa.set[i] == s)
+      return i;
+  if(dfa.n == NSTATE)
+    return -1;
+  dfa.set[dfa.n] = s;
+  memset(dfa.next[dfa.n], 0xff, sizeof(dfa.next[0]));
+  return dfa.n++;
+}
+
+// Empty the DFA, leaving only the start state.
+void
+dfareset(void)
+{
+  dfa.n = 0;
+  dfa.start = state(closure(1));
+}
+
+// Compute the transition of state t on byte c.
+int
+step(int t, int c)
+{
+  uint64 s = dfa.set[t], ns = 0;
+  int i, u;
+
+  for(i = 0; i < re.n; i++){
+    if((s & (1ULL << i)) == 0 || (re.c[i] != ANY && re.c[i] != c))
+      continue;
+    if(re.star & (1ULL << i))
+      ns |= 1ULL << i;
+    else
+      ns |= 1ULL << (i+1);
+  }
+  if(!re.bol)
+    ns |= 1;   // a match may start at any byte
+  ns = closure(ns);
+  if((u = state(ns)) < 0){
+    // cache full: start over with this state and t.
+    s = dfa.set[t];
+    dfareset();
+    t = state(s);
+    u = state(ns);
+  }
+  dfa.next[t][c] = u;
+  return u;
+}
+
+// Does state t mean the line matches?
+#define ACCEPT(t) (dfa.set[t] & (1ULL << re.n))
+
+void
+flush(void)
+{
+  if(obufn > 0)
+    write(1, obuf, obufn);
+  obufn = 0;
+}
+
+// Print the n bytes of line p, and a newline.
+void
+output(char *p, int n)
+{
+  if(obufn + n + 1 > sizeof(obuf))
+    flush();
+  if(n + 1 > sizeof(obuf)){
+    write(1, p, n);
+    write(1, "\n", 1);
+    return;
+  }
+  memmove(obuf + obufn, p, n);
+  obufn += n;
+  obuf[obufn++] = '\n';
+}
+
+// Does the n-byte line p, which holds no newline, match?
+int
+matchline(char *p, int n)
+{
+  char *e = p + n;
+  int t, u;
+
+  t = dfa.start;
+  if(ACCEPT(t) && !re.eol)
+    return 1;
+  for(; p < e; p++){
+    if((u = dfa.next[t][(uchar)*p]) < 0)
+      u = step(t, (uchar)*p);
+    t = u;
+    if(ACCEPT(t) && !re.eol)
+      return 1;
+    // anchored and nothing left to match with.
+    if(dfa.set[t] == 0)
+      return 0;
+  }
+  return ACCEPT(t) != 0;
+}
+
+// Print the lines of the n-byte chunk p that match, all but
+// the last of which end in a newline. Returns the number of
+// bytes up to and including the last newline.
+int
+grepbuf(char *pattern, char *p, int n, int slow, int all)
+{
+  char *q, *e = p + n, *s = p;
+
+  for(;;){
+    for(q = p; q < e && *q != '\n'; q++)
+      ;
+    if(q == e && !all)
+      break;
+    if(slow){
+      char c = *q;
+      *q = 0;
+      if(match(pattern, p))
+        output(p, q - p);
+      if(q < e)
+        *q = c;
+    } else if(matchline(p, q - p)){
+      output(p, q - p);
+    }
+    if(q == e){
+      p = e;
+      break;
+    }
+    p = q + 1;
+  }
+  return p - s;
+}
+
 void
 grep(char *pattern, int fd)
 {
-  int n, m;
-  char *p, *q;
+  int n, m, k, slow;
 
+  slow = compile(pattern) < 0;
+  if(!slow)
+    dfareset();
   m = 0;
+  // keep a byte spare, for the slow matcher's terminating 0.
   while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
-    }
+    k = grepbuf(pattern, buf, m, slow, 0);
+    if(k == 0 && m == sizeof(buf)-1)
+      k = grepbuf(pattern, buf, m, slow, 1);  // split a line longer than buf
+    m -= k;
+    memmove(buf, buf+k, m);
+    flush();
   }
+  if(m > 0)
+    grepbuf(pattern, buf, m, slow, 1);
+  flush();
 }
 
 int
@@ -102,4 +319,3 @@ int matchstar(int c, char *re, char *text)
   }while(*text!='\0' && (*text++==c || c=='.'));
   return 0;
 }
-
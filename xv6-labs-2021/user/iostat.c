@@ -0,0 +1,69 @@
+// iostat [command [arg ...]]
+//
+// Prints the disk's request counts, bytes, service times and
+// queue depth, and the buffer cache's hit rate. With a command,
+// counts only its I/O; the maximums are still since boot.
+// Times are in ticks of the time CSR (10MHz in qemu).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+void
+get(struct iostat *st)
+{
+  if(iostat(st) < 0){
+    fprintf(2, "iostat: iostat failed\n");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct iostat st0, st;
+  uint64 nreq;
+  int pid;
+
+  memset(&st0, 0, sizeof(st0));
+  if(argc > 1){
+    get(&st0);
+    if((pid = fork()) < 0){
+      fprintf(2, "iostat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "iostat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  get(&st);
+
+  st.nread -= st0.nread;
+  st.nwrite -= st0.nwrite;
+  st.rbytes -= st0.rbytes;
+  st.wbytes -= st0.wbytes;
+  st.svctime -= st0.svctime;
+  st.inflight -= st0.inflight;
+  st.elapsed -= st0.elapsed;
+  st.bhit -= st0.bhit;
+  st.bmiss -= st0.bmiss;
+
+  nreq = st.nread + st.nwrite;
+  printf("disk: %l reads, %l bytes; %l writes, %l bytes\n",
+         st.nread, st.rbytes, st.nwrite, st.wbytes);
+  printf("disk: service time mean %l, max %l\n",
+         nreq ? st.svctime / nreq : 0, st.maxsvctime);
+  printf("disk: descriptors in flight mean %l.%l, max %l\n",
+         st.elapsed ? st.inflight / st.elapsed : 0,
+         st.elapsed ? (st.inflight * 10 / st.elapsed) % 10 : 0,
+         st.maxinflight);
+  printf("bcache: %l hits, %l misses", st.bhit, st.bmiss);
+  if(st.bhit + st.bmiss)
+    printf(", %l%% hit", st.bhit * 100 / (st.bhit + st.bmiss));
+  printf("\n");
+  exit(0);
+}
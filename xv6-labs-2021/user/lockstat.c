@@ -0,0 +1,111 @@
+// lockstat [command [arg ...]]
+//
+// Prints the kernel locks acquire() most often found held,
+// summed over the locks of each name. With a command, counts
+// only what happens while the command runs.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NTOP 10
+
+struct total {
+  char *name;
+  int nlock;
+  uint64 nacquire;
+  uint64 nspin;
+};
+
+// Return the counters of all locks, and their number in *np.
+struct lockstat *
+snapshot(int *np)
+{
+  struct lockstat *ls = 0;
+  int max = 0, n;
+
+  for(;;){
+    if((n = lockstat(ls, max)) < 0){
+      fprintf(2, "lockstat: lockstat failed\n");
+      exit(1);
+    }
+    if(n <= max){
+      *np = n;
+      return ls;
+    }
+    // leave room for locks made in the meantime.
+    free(ls);
+    max = n + 16;
+    if((ls = malloc(max * sizeof(*ls))) == 0){
+      fprintf(2, "lockstat: out of memory\n");
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat *before, *after;
+  struct total *tot, *t, *best;
+  int nbefore, nafter, ntot, i, j, pid;
+
+  nbefore = 0;
+  before = 0;
+  if(argc > 1){
+    before = snapshot(&nbefore);
+    if((pid = fork()) < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  after = snapshot(&nafter);
+
+  // a lock in both snapshots counts only its increase.
+  for(i = 0; i < nafter; i++){
+    for(j = 0; j < nbefore; j++){
+      if(before[j].addr == after[i].addr){
+        after[i].nacquire -= before[j].nacquire;
+        after[i].nspin -= before[j].nspin;
+        break;
+      }
+    }
+  }
+
+  if((tot = malloc(nafter * sizeof(*tot))) == 0){
+    fprintf(2, "lockstat: out of memory\n");
+    exit(1);
+  }
+  ntot = 0;
+  for(i = 0; i < nafter; i++){
+    for(t = tot; t < tot + ntot; t++)
+      if(strcmp(t->name, after[i].name) == 0)
+        break;
+    if(t == tot + ntot){
+      t->name = after[i].name;
+      t->nlock = t->nacquire = t->nspin = 0;
+      ntot++;
+    }
+    t->nlock++;
+    t->nacquire += after[i].nacquire;
+    t->nspin += after[i].nspin;
+  }
+
+  printf("lock #locks #acquire() #test-and-set\n");
+  for(i = 0; i < NTOP && i < ntot; i++){
+    best = 0;
+    for(t = tot; t < tot + ntot; t++)
+      if(t->nlock > 0 && (best == 0 || t->nspin > best->nspin))
+        best = t;
+    printf("%s %d %l %l\n", best->name, best->nlock, best->nacquire, best->nspin);
+    best->nlock = 0;   // printed
+  }
+  exit(0);
+}
@@ -0,0 +1,112 @@
+// prof command [arg ...]
+//
+// Runs command with the kernel's sampling profiler on, then
+// prints how many timer ticks landed on each pc, most first:
+//   count k pc          for kernel code
+//   count u name pc     for user code of process name
+// prof.py turns this into a profile by function, using the
+// .sym files the build writes.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/fs.h"
+#include "kernel/file.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+struct hit {
+  struct profsample s;
+  int n;
+};
+
+struct profsample buf[64];
+struct hit *hits;
+int nhit, maxhit;
+
+void
+count(struct profsample *s)
+{
+  struct hit *h, *nh;
+
+  for(h = hits; h < hits + nhit; h++)
+    if(h->s.pc == s->pc && h->s.user == s->user &&
+       (!s->user || strcmp(h->s.name, s->name) == 0))
+      break;
+  if(h == hits + nhit){
+    if(nhit == maxhit){
+      maxhit = maxhit ? 2 * maxhit : 256;
+      if((nh = malloc(maxhit * sizeof(*nh))) == 0){
+        fprintf(2, "prof: out of memory\n");
+        exit(1);
+      }
+      memmove(nh, hits, nhit * sizeof(*nh));
+      free(hits);
+      hits = nh;
+      h = hits + nhit;
+    }
+    h->s = *s;
+    h->n = 0;
+    nhit++;
+  }
+  h->n++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pid, n, i, tot;
+  struct hit *h, *best;
+
+  if(argc < 2){
+    fprintf(2, "usage: prof command [arg ...]\n");
+    exit(1);
+  }
+  if((fd = open("prof", O_RDWR)) < 0){
+    mknod("prof", PROF, 0);
+    if((fd = open("prof", O_RDWR)) < 0){
+      fprintf(2, "prof: cannot open prof device\n");
+      exit(1);
+    }
+  }
+
+  write(fd, "1", 1);
+  if((pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fd);
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  write(fd, "0", 1);
+
+  tot = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(i = 0; i < n / sizeof(buf[0]); i++)
+      count(&buf[i]);
+    tot += n / sizeof(buf[0]);
+  }
+  close(fd);
+
+  printf("# %d samples\n", tot);
+  for(;;){
+    best = 0;
+    for(h = hits; h < hits + nhit; h++)
+      if(h->n > 0 && (best == 0 || h->n > best->n))
+        best = h;
+    if(best == 0)
+      break;
+    if(best->s.user)
+      printf("%d u %s %p\n", best->n, best->s.name, best->s.pc);
+    else
+      printf("%d k %p\n", best->n, best->s.pc);
+    best->n = 0;   // printed
+  }
+  exit(0);
+}
@@ -0,0 +1,264 @@
+//
+// scale [nproc]
+//
+// run each workload in nproc processes at once (default 1) for
+// a fixed time, and print their total throughput, and the locks
+// they spun on most, one line each:
+//   scale workload nproc ops/s
+//   scalelock workload name #test-and-set #acquire()
+// the scheduler spreads the processes over the CPUs; run with
+// nproc equal to CPUS to see how the kernel scales.
+// grade-scale runs it for CPUS=1 .. 8, with NPROC set so that
+// the process table holds that many; see MAXPROC.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define RUNNS    1000000000L   // how long each workload runs
+#define NFBLOCKS 64            // blocks in each file read
+#define NTOPLOCK 3
+#define NRESERVED 4            // init, sh, scale and the log writer
+#define MAXPROC  ((NPROC - NRESERVED) / 2)  // w_fork's workers use 2 each
+
+char buf[BSIZE];
+
+// the name of worker i's file, or of the shared file if i < 0.
+char *
+fname(int i)
+{
+  static char name[8];
+
+  strcpy(name, "sc.s");
+  if(i >= 0){
+    name[3] = 'd';
+    name[4] = '0' + i / 10;
+    name[5] = '0' + i % 10;
+    name[6] = 0;
+  }
+  return name;
+}
+
+void
+mkfile(char *name)
+{
+  int fd, i;
+
+  if((fd = open(name, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "scale: cannot create %s\n", name);
+    exit(1);
+  }
+  for(i = 0; i < NFBLOCKS; i++)
+    write(fd, buf, BSIZE);
+  close(fd);
+}
+
+// each workload does one batch of operations and
+// returns how many.
+
+int
+w_sbrk(int id)
+{
+  char *p;
+  int i;
+
+  if((p = sbrk(16 * 4096)) == (char*)-1)
+    return 0;
+  for(i = 0; i < 16; i++)
+    p[i * 4096] = 1;
+  sbrk(-16 * 4096);
+  return 16;
+}
+
+int
+readfile(char *name, int id)
+{
+  int fd, i;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    return 0;
+  for(i = 0; i < NFBLOCKS; i++)
+    pread(fd, buf, BSIZE, ((i + id) % NFBLOCKS) * BSIZE);
+  close(fd);
+  return NFBLOCKS;
+}
+
+int
+w_distinct(int id)
+{
+  return readfile(fname(id), id);
+}
+
+int
+w_shared(int id)
+{
+  return readfile(fname(-1), id);
+}
+
+int
+w_fork(int id)
+{
+  int pid;
+
+  // a failed fork would look like a collapse in throughput.
+  if((pid = fork()) < 0){
+    fprintf(2, "scale: fork in worker %d failed\n", id);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(0);
+  return 1;
+}
+
+struct workload {
+  char *name;
+  int (*fn)(int);
+} workloads[] = {
+  { "sbrk",     w_sbrk },
+  { "distinct", w_distinct },
+  { "shared",   w_shared },
+  { "fork",     w_fork },
+  { 0 },
+};
+
+struct lockstat *
+snapshot(int *np)
+{
+  struct lockstat *ls = 0;
+  int max = 0, n;
+
+  while((n = lockstat(ls, max)) > max){
+    free(ls);
+    max = n + 16;
+    if((ls = malloc(max * sizeof(*ls))) == 0){
+      fprintf(2, "scale: out of memory\n");
+      exit(1);
+    }
+  }
+  *np = n < 0 ? 0 : n;
+  return ls;
+}
+
+// print the NTOPLOCK lock names with the most spins
+// between snapshots before and after.
+void
+toplocks(char *wname, struct lockstat *before, int nbefore,
+         struct lockstat *after, int nafter)
+{
+  struct lockstat *tot, *t, *best;
+  int ntot, i, j;
+
+  if((tot = malloc((nafter + 1) * sizeof(*tot))) == 0)
+    return;
+  ntot = 0;
+  for(i = 0; i < nafter; i++){
+    for(j = 0; j < nbefore; j++){
+      if(before[j].addr == after[i].addr){
+        after[i].nacquire -= before[j].nacquire;
+        after[i].nspin -= before[j].nspin;
+        break;
+      }
+    }
+    for(t = tot; t < tot + ntot; t++)
+      if(strcmp(t->name, after[i].name) == 0)
+        break;
+    if(t == tot + ntot){
+      *t = after[i];
+      ntot++;
+    } else {
+      t->nacquire += after[i].nacquire;
+      t->nspin += after[i].nspin;
+    }
+  }
+  for(i = 0; i < NTOPLOCK; i++){
+    best = 0;
+    for(t = tot; t < tot + ntot; t++)
+      if(t->addr && (best == 0 || t->nspin > best->nspin))
+        best = t;
+    if(best == 0 || best->nspin == 0)
+      break;
+    printf("scalelock %s %s %l %l\n", wname, best->name, best->nspin, best->nacquire);
+    best->addr = 0;   // printed
+  }
+  free(tot);
+}
+
+void
+run(struct workload *w, int nproc)
+{
+  struct lockstat *before, *after;
+  int nbefore, nafter, i, pid, n, fds[2], xstatus;
+  uint64 t0, tot, ops;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "scale: pipe failed\n");
+    exit(1);
+  }
+  before = snapshot(&nbefore);
+  t0 = nsec();
+  for(i = 0; i < nproc; i++){
+    if((pid = fork()) < 0){
+      fprintf(2, "scale: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      ops = 0;
+      while(nsec() - t0 < RUNNS)
+        ops += w->fn(i);
+      write(fds[1], &ops, sizeof(ops));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], &ops, sizeof(ops))) == sizeof(ops))
+    tot += ops;
+  close(fds[0]);
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      fprintf(2, "scale: %s worker failed\n", w->name);
+      exit(1);
+    }
+  }
+  t0 = nsec() - t0;
+  after = snapshot(&nafter);
+
+  printf("scale %s %d %l\n", w->name, nproc, tot * 1000000000L / t0);
+  toplocks(w->name, before, nbefore, after, nafter);
+  free(before);
+  free(after);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct workload *w;
+  int nproc, i;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 1;
+  if(nproc < 1 || nproc > MAXPROC){
+    fprintf(2, "usage: scale [nproc], nproc at most %d\n", MAXPROC);
+    exit(1);
+  }
+
+  mkfile(fname(-1));
+  for(i = 0; i < nproc; i++)
+    mkfile(fname(i));
+
+  for(w = workloads; w->name; w++)
+    run(w, nproc);
+
+  unlink(fname(-1));
+  for(i = 0; i < nproc; i++)
+    unlink(fname(i));
+  printf("scale: done\n");
+  exit(0);
+}
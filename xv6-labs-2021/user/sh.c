@@ -1,8 +1,24 @@
 // Shell.
+//
+// The shell starts each program of a command with spawn(), which
+// runs it in a new process without copying the shell's memory,
+// and hands it just its standard input, output and error. The
+// stages of a pipeline all start before the shell waits for any
+// of them. Only a ( ) block, or a ; or & inside one, forks a copy
+// of the shell to run it.
+//
+// A command ending in & is a background job: the shell notes
+// its processes in jobs[], and collects them with waitpid()
+// while it waits for other commands, reporting each job done at
+// the prompt after it exits.
 
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/memlayout.h"
+#include "kernel/param.h"
+#include "kernel/rusage.h"
+#include "kernel/wait.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -12,6 +28,8 @@
 #define BACK  5
 
 #define MAXARGS 10
+#define MAXLINE 100
+#define NJOB    16
 
 struct cmd {
   int type;
@@ -49,9 +67,20 @@ struct backcmd {
   struct cmd *cmd;
 };
 
+// a background job; jobs[i] is job number i+1.
+struct job {
+  int n;                // # of its processes not yet collected
+  int pid[NPROC];       // its processes, 0 once collected
+  char line[MAXLINE];   // the command, for messages
+} jobs[NJOB];
+
+int stdfd[3] = { 0, 1, 2 };  // the shell's own standard fds
+
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+void timecmd(char*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +159,193 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Start cmd with fd[0], fd[1] and fd[2] as its standard input,
+// output and error, without waiting for it. Adds the pids of
+// the processes it starts to pid[], and their number to *n.
+// Returns -1 if any part of cmd could not be started.
+int
+start(struct cmd *cmd, int *fd, int *pid, int *n)
+{
+  int p[2], nfd[3], i, r;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return -1;
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return -1;
+    if((r = spawn(ecmd->argv[0], ecmd->argv, fd, 3)) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return -1;
+    }
+    pid[(*n)++] = r;
+    return 0;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    memmove(nfd, fd, sizeof(nfd));
+    if((nfd[rcmd->fd] = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return -1;
+    }
+    r = start(rcmd->cmd, nfd, pid, n);
+    close(nfd[rcmd->fd]);
+    return r;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return -1;
+    }
+    memmove(nfd, fd, sizeof(nfd));
+    nfd[1] = p[1];
+    r = start(pcmd->left, nfd, pid, n);
+    nfd[0] = p[0];
+    nfd[1] = fd[1];
+    if(start(pcmd->right, nfd, pid, n) < 0)
+      r = -1;
+    close(p[0]);
+    close(p[1]);
+    return r;
+  }
+
+  // a block, or & or ; within one: run it in a copy of the shell.
+  if((r = fork()) < 0){
+    fprintf(2, "fork failed\n");
+    return -1;
+  }
+  if(r == 0){
+    for(i = 0; i < 3; i++)
+      nfd[i] = dup(fd[i]);
+    for(i = 0; i < 3; i++){
+      close(i);
+      dup(nfd[i]);
+    }
+    for(i = 3; i < NOFILE; i++)
+      close(i);
+    runcmd(cmd);
+  }
+  pid[(*n)++] = r;
+  return 0;
+}
+
+// Note that process pid has exited, and if that was the last
+// of its job, say so.
+void
+reaped(int pid)
+{
+  struct job *j;
+  int i;
+
+  for(j = jobs; j < &jobs[NJOB]; j++){
+    for(i = 0; i < j->n && j->pid[i] != pid; i++)
+      ;
+    if(j->n == 0 || i == j->n)
+      continue;
+    j->pid[i] = j->pid[--j->n];
+    if(j->n == 0)
+      fprintf(2, "[%d] done %s\n", (int)(j - jobs) + 1, j->line);
+    return;
+  }
+}
+
+// Collect whichever background processes have exited.
+void
+reapjobs(void)
+{
+  int pid;
+
+  while((pid = waitpid(-1, 0, WNOHANG)) > 0)
+    reaped(pid);
+}
+
+// Start cmd in the background, as a job with command line line.
+void
+background(struct cmd *cmd, char *line)
+{
+  struct job *j;
+
+  for(j = jobs; j < &jobs[NJOB] && j->n > 0; j++)
+    ;
+  if(j == &jobs[NJOB]){
+    fprintf(2, "too many jobs\n");
+    return;
+  }
+  start(cmd, stdfd, j->pid, &j->n);
+  if(j->n == 0)
+    return;
+  strcpy(j->line, line);
+  fprintf(2, "[%d] %d\n", (int)(j - jobs) + 1, j->pid[j->n-1]);
+}
+
+// Run the parsed command line cmd, whose text is line.
+void
+run(struct cmd *cmd, char *line)
+{
+  int pid[NPROC], i, n;
+
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case LIST:
+    run(((struct listcmd*)cmd)->left, line);
+    run(((struct listcmd*)cmd)->right, line);
+    break;
+
+  case BACK:
+    background(((struct backcmd*)cmd)->cmd, line);
+    break;
+
+  default:
+    n = 0;
+    start(cmd, stdfd, pid, &n);
+    for(i = 0; i < n; i++)
+      waitpid(pid[i], 0, 0);
+    break;
+  }
+}
+
+// The jobs and wait builtins. Returns 0 if line is neither.
+int
+jobcmd(char *line)
+{
+  struct job *j;
+  int i, pid;
+
+  if(strcmp(line, "jobs") == 0){
+    for(j = jobs; j < &jobs[NJOB]; j++)
+      if(j->n > 0)
+        printf("[%d] running %s\n", (int)(j - jobs) + 1, j->line);
+    return 1;
+  }
+  if(strcmp(line, "wait") == 0){
+    while((pid = waitpid(-1, 0, 0)) > 0)
+      reaped(pid);
+    return 1;
+  }
+  if(memcmp(line, "wait ", 5) == 0){
+    i = atoi(line + 5);
+    if(i < 1 || i > NJOB || jobs[i-1].n == 0){
+      fprintf(2, "wait: no job %s\n", line + 5);
+      return 1;
+    }
+    j = &jobs[i-1];
+    while(j->n > 0){
+      pid = j->pid[0];
+      waitpid(pid, 0, 0);
+      reaped(pid);
+    }
+    return 1;
+  }
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -144,7 +360,8 @@ getcmd(char *buf, int nbuf)
 int
 main(void)
 {
-  static char buf[100];
+  static char buf[MAXLINE], line[MAXLINE];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -156,7 +373,10 @@ main(void)
   }
 
   // Read and run input commands.
-  while(getcmd(buf, sizeof(buf)) >= 0){
+  for(;;){
+    reapjobs();
+    if(getcmd(buf, sizeof(buf)) < 0)
+      break;
     if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
       // Chdir must be called by the parent, not the child.
       buf[strlen(buf)-1] = 0;  // chop \n
@@ -164,13 +384,60 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if(memcmp(buf, "time ", 5) == 0){
+      timecmd(buf+5);
+      continue;
+    }
+    strcpy(line, buf);
+    if(line[strlen(line)-1] == '\n')
+      line[strlen(line)-1] = 0;  // chop \n
+    if(jobcmd(line))
+      continue;
+    cmd = parsecmd(buf);
+    run(cmd, line);
+    freecmd(cmd);
   }
   exit(0);
 }
 
+// print ns nanoseconds as seconds, to the millisecond.
+void
+prsecs(char *what, uint64 ns)
+{
+  uint64 ms = ns / 1000000;
+
+  fprintf(2, "%s %l.%d%d%ds ", what, ms / 1000,
+          (int)(ms / 100 % 10), (int)(ms / 10 % 10), (int)(ms % 10));
+}
+
+// the time builtin: run cmd, then print how long it took,
+// and what it and its children used.
+void
+timecmd(char *cmd)
+{
+  struct rusage ru;
+  uint64 t0;
+  int pid, r;
+
+  t0 = nsec();
+  if((pid = fork1()) == 0)
+    runcmd(parsecmd(cmd));
+  // background jobs may exit meanwhile.
+  while((r = wait3(0, &ru)) != pid){
+    if(r < 0){
+      fprintf(2, "time: wait3 failed\n");
+      return;
+    }
+    reaped(r);
+  }
+  t0 = nsec() - t0;
+  prsecs("real", t0);
+  prsecs("user", ru.utime * (1000000000L / TIMEBASE));
+  prsecs("sys", ru.stime * (1000000000L / TIMEBASE));
+  fprintf(2, "\n%l faults %l in %l out %l+%l csw\n", ru.nfault,
+          ru.inblock, ru.oublock, ru.nvcsw, ru.nivcsw);
+}
+
 void
 panic(char *s)
 {
@@ -256,8 +523,44 @@ backcmd(struct cmd *subcmd)
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
 }
+// Free cmd and its parts.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+  case LIST:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
+
 //PAGEBREAK!
 // Parsing
+//
+// The shell itself parses each line, so a syntax error must not
+// exit: synerr() reports the first error of a line, and the
+// parser stops where it is, leaving parsecmd() to return 0.
+
+int syntaxerr;
+
+void
+synerr(char *s)
+{
+  if(!syntaxerr)
+    fprintf(2, "%s\n", s);
+  syntaxerr = 1;
+}
 
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
@@ -330,12 +633,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !syntaxerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    synerr("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +687,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      synerr("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +715,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    synerr("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +743,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      synerr("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      synerr("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -0,0 +1,122 @@
+// sysstat [command [arg ...]]
+//
+// Prints, for each system call that was made, the number of
+// calls, their mean time and a histogram of their times by
+// powers of two, in ticks of the time CSR (10MHz in qemu).
+// With a command, counts only the calls made while it runs.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/syscall.h"
+#include "kernel/sysstat.h"
+#include "user/user.h"
+
+char *names[] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_setprio] "setprio",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_copy_file_range] "copy_file_range",
+[SYS_fsync]   "fsync",
+[SYS_lockstat] "lockstat",
+[SYS_sysstat] "sysstat",
+[SYS_iostat]  "iostat",
+[SYS_clocktime] "clocktime",
+[SYS_wait3]   "wait3",
+[SYS_getrusage] "getrusage",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex_wait] "futex_wait",
+[SYS_futex_wake] "futex_wake",
+[SYS_poll]    "poll",
+[SYS_spawn]   "spawn",
+[SYS_waitpid] "waitpid",
+};
+
+struct sysstat *
+snapshot(int n)
+{
+  struct sysstat *s;
+
+  if((s = malloc(n * sizeof(*s))) == 0){
+    fprintf(2, "sysstat: out of memory\n");
+    exit(1);
+  }
+  if(sysstat(s, n) < 0){
+    fprintf(2, "sysstat: sysstat failed\n");
+    exit(1);
+  }
+  return s;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sysstat *before, *after, *s;
+  int n, num, i, pid;
+
+  if((n = sysstat(0, 0)) < 0){
+    fprintf(2, "sysstat: sysstat failed\n");
+    exit(1);
+  }
+  before = 0;
+  if(argc > 1){
+    before = snapshot(n);
+    if((pid = fork()) < 0){
+      fprintf(2, "sysstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "sysstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  after = snapshot(n);
+
+  for(num = 0; num < n; num++){
+    s = &after[num];
+    if(before){
+      s->count -= before[num].count;
+      s->time -= before[num].time;
+      for(i = 0; i < NSYSHIST; i++)
+        s->hist[i] -= before[num].hist[i];
+    }
+    if(s->count == 0)
+      continue;
+    if(num < sizeof(names)/sizeof(names[0]) && names[num])
+      printf("%s", names[num]);
+    else
+      printf("syscall %d", num);
+    printf(": %l calls, mean %l\n", s->count, s->time / s->count);
+    for(i = 0; i < NSYSHIST; i++)
+      if(s->hist[i])
+        printf("  %s%l: %l\n", i == NSYSHIST-1 ? ">=" : "", i ? 1L << i : 0L, s->hist[i]);
+  }
+  exit(0);
+}
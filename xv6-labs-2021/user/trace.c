@@ -0,0 +1,78 @@
+// trace command [arg ...]
+//
+// Runs command with the kernel's event trace on, then
+// prints the recorded events, one per line:
+//   ev time cpu pid type arg
+// trace.py turns this into a timeline for chrome://tracing
+// or Perfetto.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/fs.h"
+#include "kernel/file.h"
+#include "kernel/fcntl.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+char *names[NTRTYPE] = {
+[TR_RUN]        "run",
+[TR_DESCHED]    "desched",
+[TR_SCHED]      "sched",
+[TR_SLEEP]      "sleep",
+[TR_WAKEUP]     "wakeup",
+[TR_TRAP]       "trap",
+[TR_TRAPRET]    "trapret",
+[TR_DISKSUBMIT] "disksubmit",
+[TR_DISKDONE]   "diskdone",
+[TR_BEGINOP]    "beginop",
+[TR_ENDOP]      "endop",
+[TR_COMMIT]     "commit",
+[TR_COMMITDONE] "commitdone",
+};
+
+struct traceev ev[64];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pid, n, i;
+  struct traceev *e;
+
+  if(argc < 2){
+    fprintf(2, "usage: trace command [arg ...]\n");
+    exit(1);
+  }
+  if((fd = open("trace", O_RDWR)) < 0){
+    mknod("trace", TRACE, 0);
+    if((fd = open("trace", O_RDWR)) < 0){
+      fprintf(2, "trace: cannot open trace device\n");
+      exit(1);
+    }
+  }
+
+  write(fd, "1", 1);
+  if((pid = fork()) < 0){
+    fprintf(2, "trace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fd);
+    exec(argv[1], argv + 1);
+    fprintf(2, "trace: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  write(fd, "0", 1);
+
+  while((n = read(fd, ev, sizeof(ev))) > 0){
+    for(i = 0; i < n / sizeof(ev[0]); i++){
+      e = &ev[i];
+      printf("ev %l %d %d %s %p\n", e->time, e->cpu, e->pid,
+             e->type < NTRTYPE && names[e->type] ? names[e->type] : "?", e->arg);
+    }
+  }
+  close(fd);
+  exit(0);
+}
@@ -0,0 +1,443 @@
+//
+// ubench [name ...]
+//
+// time basic kernel operations, or only the named ones. each
+// benchmark runs n operations, doubling n until they take at
+// least MINNS nanoseconds, and prints one line:
+//   ubench name n unit ns ns/unit
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define MINNS     200000000L
+#define MAXN      (1 << 20)
+
+#define RANDBLOCKS 1024   // size of the random-access file, in blocks
+#define NBIGDIR    1000   // entries in the lookup directory
+
+char *prog;
+char buf[8192];
+
+unsigned long rand_next = 1;
+
+// from FreeBSD, as in grind.c.
+int
+rand(void)
+{
+  long hi, lo, x;
+
+  x = (rand_next % 0x7ffffffe) + 1;
+  hi = x / 127773;
+  lo = x % 127773;
+  x = 16807 * lo - 2836 * hi;
+  if(x < 0)
+    x += 0x7fffffff;
+  x--;
+  rand_next = x;
+  return x;
+}
+
+void
+fail(char *what)
+{
+  fprintf(2, "ubench: %s failed\n", what);
+  exit(1);
+}
+
+// the name of file i, with prefix p.
+char *
+fname(char *p, int i)
+{
+  static char name[32];
+  int n, j;
+
+  strcpy(name, p);
+  n = strlen(name);
+  j = 1;
+  while(j * 10 <= i)
+    j *= 10;
+  for(; j > 0; j /= 10)
+    name[n++] = '0' + (i / j) % 10;
+  name[n] = 0;
+  return name;
+}
+
+// make file name hold nblocks blocks, if it doesn't already.
+void
+mkfile(char *name, int nblocks)
+{
+  struct stat st;
+  int fd, i;
+
+  if(stat(name, &st) == 0 && st.size == nblocks * BSIZE)
+    return;
+  if((fd = open(name, O_CREATE|O_TRUNC|O_WRONLY)) < 0)
+    fail("create");
+  for(i = 0; i < nblocks; i++)
+    if(write(fd, buf, BSIZE) != BSIZE)
+      fail("write");
+  close(fd);
+}
+
+// each benchmark does n operations and returns the
+// nanoseconds they took, leaving out its setup.
+
+uint64
+b_getpid(int n)
+{
+  uint64 t0 = nsec();
+
+  while(n-- > 0)
+    getpid();
+  return nsec() - t0;
+}
+
+uint64
+b_fork(int n)
+{
+  uint64 t0 = nsec();
+  int pid;
+
+  while(n-- > 0){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  return nsec() - t0;
+}
+
+uint64
+b_forkexec(int n)
+{
+  uint64 t0 = nsec();
+  int pid;
+  char *argv[] = { prog, "-exit", 0 };
+
+  while(n-- > 0){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(prog, argv);
+      fail("exec");
+    }
+    wait(0);
+  }
+  return nsec() - t0;
+}
+
+// n round trips of one byte between two processes.
+uint64
+b_pipelat(int n)
+{
+  int p1[2], p2[2], pid, i;
+  uint64 t0;
+  char c = 0;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      if(read(p1[0], &c, 1) != 1 || write(p2[1], &c, 1) != 1)
+        fail("pipe echo");
+    }
+    exit(0);
+  }
+  t0 = nsec();
+  for(i = 0; i < n; i++){
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1)
+      fail("pipe ping");
+  }
+  t0 = nsec() - t0;
+  wait(0);
+  close(p1[0]); close(p1[1]); close(p2[0]); close(p2[1]);
+  return t0;
+}
+
+// send n KB through a pipe, 8KB at a time.
+uint64
+b_pipebw(int n)
+{
+  int p[2], pid, m, tot;
+  uint64 t0;
+
+  if(pipe(p) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(p[0]);
+    for(tot = 0; tot < n * 1024; tot += m){
+      m = n * 1024 - tot;
+      if(m > sizeof(buf))
+        m = sizeof(buf);
+      if(write(p[1], buf, m) != m)
+        fail("pipe write");
+    }
+    exit(0);
+  }
+  close(p[1]);
+  t0 = nsec();
+  tot = 0;
+  while((m = read(p[0], buf, sizeof(buf))) > 0)
+    tot += m;
+  t0 = nsec() - t0;
+  close(p[0]);
+  wait(0);
+  if(tot != n * 1024)
+    fail("pipe read");
+  return t0;
+}
+
+// grow the heap by n pages, touching each, then shrink it.
+uint64
+b_sbrk(int n)
+{
+  uint64 t0 = nsec();
+  int i;
+  char *p;
+
+  for(i = 0; i < n; i++){
+    if((p = sbrk(4096)) == (char*)-1)
+      fail("sbrk");
+    *p = 1;
+  }
+  sbrk(-4096 * n);
+  return nsec() - t0;
+}
+
+// n malloc()s of small blocks of mixed sizes, freed in
+// batches of 64, so that the heap stays fragmented.
+uint64
+b_malloc(int n)
+{
+  uint64 t0 = nsec();
+  char *p[64];
+  int i, j;
+
+  for(i = 0; i < n; i += 64){
+    for(j = 0; j < 64; j++)
+      if((p[j] = malloc(16 + (rand() % 32) * 16)) == 0)
+        fail("malloc");
+    for(j = 0; j < 64; j += 2)
+      free(p[j]);
+    for(j = 1; j < 64; j += 2)
+      free(p[j]);
+  }
+  return nsec() - t0;
+}
+
+uint64
+b_seqwrite(int n)
+{
+  int fd, i;
+  uint64 t0;
+
+  if((fd = open("ub.seq", O_CREATE|O_TRUNC|O_WRONLY)) < 0)
+    fail("create");
+  t0 = nsec();
+  for(i = 0; i < n; i++)
+    if(write(fd, buf, BSIZE) != BSIZE)
+      fail("write");
+  close(fd);
+  t0 = nsec() - t0;
+  unlink("ub.seq");
+  return t0;
+}
+
+// read n blocks sequentially, rereading the file as needed.
+uint64
+b_seqread(int n)
+{
+  int fd, i;
+  uint64 t0;
+
+  mkfile("ub.seqr", RANDBLOCKS);
+  if((fd = open("ub.seqr", O_RDONLY)) < 0)
+    fail("open");
+  t0 = nsec();
+  for(i = 0; i < n; i++)
+    if(pread(fd, buf, BSIZE, (i % RANDBLOCKS) * BSIZE) != BSIZE)
+      fail("read");
+  t0 = nsec() - t0;
+  close(fd);
+  return t0;
+}
+
+uint64
+b_randread(int n)
+{
+  int fd, i;
+  uint64 t0;
+
+  mkfile("ub.rand", RANDBLOCKS);
+  if((fd = open("ub.rand", O_RDONLY)) < 0)
+    fail("open");
+  t0 = nsec();
+  for(i = 0; i < n; i++)
+    if(pread(fd, buf, BSIZE, (rand() % RANDBLOCKS) * BSIZE) != BSIZE)
+      fail("read");
+  t0 = nsec() - t0;
+  close(fd);
+  return t0;
+}
+
+uint64
+b_randwrite(int n)
+{
+  int fd, i;
+  uint64 t0;
+
+  mkfile("ub.rand", RANDBLOCKS);
+  if((fd = open("ub.rand", O_WRONLY)) < 0)
+    fail("open");
+  t0 = nsec();
+  for(i = 0; i < n; i++)
+    if(pwrite(fd, buf, BSIZE, (rand() % RANDBLOCKS) * BSIZE) != BSIZE)
+      fail("write");
+  close(fd);
+  t0 = nsec() - t0;
+  return t0;
+}
+
+uint64
+b_create(int n)
+{
+  int fd, i;
+  uint64 t0;
+
+  t0 = nsec();
+  for(i = 0; i < n; i++){
+    if((fd = open(fname("ub.c", i), O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+  }
+  t0 = nsec() - t0;
+  for(i = 0; i < n; i++)
+    unlink(fname("ub.c", i));
+  return t0;
+}
+
+uint64
+b_unlink(int n)
+{
+  int fd, i;
+  uint64 t0;
+
+  for(i = 0; i < n; i++){
+    if((fd = open(fname("ub.u", i), O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+  }
+  t0 = nsec();
+  for(i = 0; i < n; i++)
+    if(unlink(fname("ub.u", i)) < 0)
+      fail("unlink");
+  return nsec() - t0;
+}
+
+// n lookups of random names in a directory of NBIGDIR files.
+uint64
+b_lookup(int n)
+{
+  struct stat st;
+  int fd, i;
+  uint64 t0;
+
+  mkdir("ub.dir");
+  if(stat("ub.dir/f0", &st) < 0 || stat(fname("ub.dir/f", NBIGDIR-1), &st) < 0){
+    for(i = 0; i < NBIGDIR; i++){
+      if((fd = open(fname("ub.dir/f", i), O_CREATE|O_RDWR)) < 0)
+        fail("create");
+      close(fd);
+    }
+  }
+  t0 = nsec();
+  for(i = 0; i < n; i++)
+    if(stat(fname("ub.dir/f", rand() % NBIGDIR), &st) < 0)
+      fail("stat");
+  return nsec() - t0;
+}
+
+struct bench {
+  char *name;
+  uint64 (*fn)(int);
+  char *unit;
+  int maxn;
+} benches[] = {
+  { "getpid",    b_getpid,    "call",   MAXN },
+  { "fork",      b_fork,      "fork",   MAXN },
+  { "forkexec",  b_forkexec,  "exec",   MAXN },
+  { "pipelat",   b_pipelat,   "trip",   MAXN },
+  { "pipebw",    b_pipebw,    "KB",     MAXN },
+  { "sbrk",      b_sbrk,      "page",   4096 },
+  { "malloc",    b_malloc,    "malloc", MAXN },
+  { "seqwrite",  b_seqwrite,  "block",  16384 },
+  { "seqread",   b_seqread,   "block",  MAXN },
+  { "randread",  b_randread,  "block",  MAXN },
+  { "randwrite", b_randwrite, "block",  MAXN },
+  { "create",    b_create,    "file",   4096 },
+  { "unlink",    b_unlink,    "file",   4096 },
+  { "lookup",    b_lookup,    "lookup", MAXN },
+  { 0 },
+};
+
+void
+run(struct bench *b)
+{
+  uint64 t;
+  int n;
+
+  for(n = 1; ; n *= 2){
+    t = b->fn(n);
+    if(t >= MINNS || n * 2 > b->maxn)
+      break;
+  }
+  printf("ubench %s %d %s %l %l\n", b->name, n, b->unit, t, t / n);
+}
+
+void
+cleanup(void)
+{
+  int i;
+
+  unlink("ub.seqr");
+  unlink("ub.rand");
+  for(i = 0; i < NBIGDIR; i++)
+    unlink(fname("ub.dir/f", i));
+  unlink("ub.dir");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bench *b;
+  int i;
+
+  if(argc == 2 && strcmp(argv[1], "-exit") == 0)
+    exit(0);
+  prog = argv[0];
+
+  printf("# name n unit ns ns/unit\n");
+  for(b = benches; b->name; b++){
+    if(argc > 1){
+      for(i = 1; i < argc; i++)
+        if(strcmp(argv[i], b->name) == 0)
+          break;
+      if(i == argc)
+        continue;
+    }
+    run(b);
+  }
+  cleanup();
+  printf("ubench: done\n");
+  exit(0);
+}
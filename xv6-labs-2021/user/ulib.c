@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +135,43 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// the time since boot in nanoseconds, read straight
+// from the time CSR, which the kernel lets user code
+// read, so without a system call.
+uint64
+nsec(void)
+{
+  uint64 t;
+
+  asm volatile("rdtime %0" : "=r" (t));
+  return t / TIMEBASE * 1000000000L + t % TIMEBASE * (1000000000L / TIMEBASE);
+}
+
+// a mutex for threads sharing memory: *m is 0 when free,
+// 1 when held, and 2 when held with threads maybe waiting,
+// as in Drepper's "Futexes Are Tricky". only a contended
+// lock or unlock makes a system call.
+void
+mutex_lock(int *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(m, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex_wait(m, 2);
+    c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(int *m)
+{
+  if(__atomic_fetch_sub(m, 1, __ATOMIC_RELEASE) != 1){
+    __atomic_store_n(m, 0, __ATOMIC_RELEASE);
+    futex_wake(m, 1);
+  }
+}
@@ -3,30 +3,55 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small blocks, of up to MAXSMALL bytes with their header, come
+// in NCLASS power-of-two size classes, each with a free list of
+// its own, so malloc() and free() of one take constant time. A
+// class whose list is empty carves a new block off the current
+// CHUNK of memory from sbrk(). Freed small blocks stay in their
+// class.
+//
+// Larger blocks are taken from sbrk() and managed by the
+// allocator of Kernighan and Ritchie, The C Programming
+// Language, 2nd ed., Section 8.7: a first-fit circular free
+// list that coalesces neighbours on free().
+//
+// One mutex guards it all, for threads sharing the heap; it
+// costs no system call unless the heap is contended.
 
 typedef long Align;
 
 union header {
   struct {
     union header *ptr;
-    uint size;
+    uint size;   // in units of Header, or SMALL|class
   } s;
   Align x;
 };
 
 typedef union header Header;
 
+#define MINSHIFT 5              // smallest class holds 32 bytes
+#define NCLASS   8              // ... and the largest 4096
+#define MAXSMALL (1 << (MINSHIFT + NCLASS - 1))
+#define SMALL    0x80000000
+#define CHUNK    (16 * 4096)    // bytes sbrk()ed at once for small blocks
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+static Header *classfree[NCLASS];
+static char *chunkp, *chunkend;   // the rest of the current chunk
+
+static int mlock;
+
+// Free a large block, as Kernighan and Ritchie do.
+static void
+lfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,6 +68,26 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  Header *bp;
+  uint c;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  mutex_lock(&mlock);
+  if(bp->s.size & SMALL){
+    c = bp->s.size & ~SMALL;
+    bp->s.ptr = classfree[c];
+    classfree[c] = bp;
+  } else {
+    lfree(bp);
+  }
+  mutex_unlock(&mlock);
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,17 +101,16 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  lfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// Allocate nunits units first-fit from the large free list.
+static void*
+lmalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -88,3 +132,52 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// Allocate a block of class c, of 1 << (MINSHIFT+c) bytes.
+static void*
+smalloc(uint c)
+{
+  Header *bp;
+  uint n = 1 << (MINSHIFT + c);
+  char *p;
+
+  if((bp = classfree[c]) != 0){
+    classfree[c] = bp->s.ptr;
+  } else {
+    if(chunkend - chunkp < n){
+      // the rest of the old chunk is lost to the small classes.
+      if((p = sbrk(CHUNK)) != (char*)-1){
+        chunkp = p;
+        chunkend = p + CHUNK;
+      } else if((p = sbrk(n)) != (char*)-1){
+        chunkp = p;
+        chunkend = p + n;
+      } else {
+        return 0;
+      }
+    }
+    bp = (Header*)chunkp;
+    chunkp += n;
+  }
+  bp->s.size = SMALL | c;
+  return (void*)(bp + 1);
+}
+
+void*
+malloc(uint nbytes)
+{
+  uint n, c;
+  void *p;
+
+  n = nbytes + sizeof(Header);
+  mutex_lock(&mlock);
+  if(nbytes <= MAXSMALL - sizeof(Header)){
+    for(c = 0; (1 << (MINSHIFT + c)) < n; c++)
+      ;
+    p = smalloc(c);
+  } else {
+    p = lmalloc((nbytes + sizeof(Header) - 1)/sizeof(Header) + 1);
+  }
+  mutex_unlock(&mlock);
+  return p;
+}
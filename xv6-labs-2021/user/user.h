@@ -1,5 +1,11 @@
 struct stat;
 struct rtcdate;
+struct iovec;
+struct lockstat;
+struct sysstat;
+struct iostat;
+struct rusage;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -23,6 +29,28 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int setprio(int, int);
+void *mmap(void *, int, int, int, int, int);
+int munmap(void *, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int copy_file_range(int, int, int);
+int fsync(int);
+int lockstat(struct lockstat*, int);
+int sysstat(struct sysstat*, int);
+int iostat(struct iostat*);
+uint64 clocktime(void);
+int wait3(int*, struct rusage*);
+int getrusage(int, struct rusage*);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int poll(struct pollfd*, int, int);
+int spawn(char*, char**, int*, int);
+int waitpid(int, int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +68,6 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+uint64 nsec(void);
+void mutex_lock(int*);
+void mutex_unlock(int*);
@@ -7,6 +7,11 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/uio.h"
+#include "kernel/lockstat.h"
+#include "kernel/rusage.h"
+#include "kernel/poll.h"
+#include "kernel/wait.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -569,6 +574,10 @@ writetest(char *s)
   }
 }
 
+// with large blocks, the disk fills up before a file of
+// MAXFILE blocks does.
+#define BIGBLOCKS (MAXFILE < FSSIZE/2 ? MAXFILE : FSSIZE/2)
+
 void
 writebig(char *s)
 {
@@ -580,7 +589,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -600,7 +609,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -724,6 +733,99 @@ exectest(char *s)
 
 }
 
+// spawn() runs a program with just the fds it is given,
+// and fails without leaving a child if the exec fails.
+void
+spawntest(char *s)
+{
+  int fds[2], fd[3], pid, xstatus, n;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char *noargv[] = { "nosuchprogram", 0 };
+  char buf[8];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  fd[0] = 0;
+  fd[1] = fds[1];
+  fd[2] = 2;
+  if((pid = spawn("echo", echoargv, fd, 3)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  // the child holds no copy of fds[0], so this sees EOF.
+  n = 0;
+  while(n < sizeof(buf) && read(fds[0], buf+n, 1) == 1)
+    n++;
+  close(fds[0]);
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K' || buf[2] != '\n'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", noargv, fd, 0) >= 0){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  fd[0] = NOFILE - 1;
+  if(spawn("echo", echoargv, fd, 1) >= 0){
+    printf("%s: spawn with a closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// waitpid() waits for just the named child, or with WNOHANG
+// not at all.
+void
+waitpidtest(char *s)
+{
+  int pid1, pid2, xstatus;
+
+  pid1 = fork();
+  if(pid1 < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid1 == 0){
+    sleep(10);
+    exit(7);
+  }
+  pid2 = fork();
+  if(pid2 < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid2 == 0)
+    exit(8);
+
+  if(waitpid(pid1, &xstatus, WNOHANG) != 0){
+    printf("%s: WNOHANG did not return 0\n", s);
+    exit(1);
+  }
+  if(waitpid(pid1, &xstatus, 0) != pid1 || xstatus != 7){
+    printf("%s: waitpid(pid1) failed\n", s);
+    exit(1);
+  }
+  if(waitpid(pid2, &xstatus, 0) != pid2 || xstatus != 8){
+    printf("%s: waitpid(pid2) failed\n", s);
+    exit(1);
+  }
+  if(waitpid(-1, 0, WNOHANG) != -1 || waitpid(0, 0, 0) != -1){
+    printf("%s: waitpid with no children succeeded\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -779,90 +881,862 @@ pipe1(char *s)
   }
 }
 
-
-// test if child is killed (status = -1)
+
+// test if child is killed (status = -1)
+void
+killstatus(char *s)
+{
+  int xst;
+  
+  for(int i = 0; i < 100; i++){
+    int pid1 = fork();
+    if(pid1 < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid1 == 0){
+      while(1) {
+        getpid();
+      }
+      exit(0);
+    }
+    sleep(1);
+    kill(pid1);
+    wait(&xst);
+    if(xst != -1) {
+       printf("%s: status should be -1\n", s);
+       exit(1);
+    }
+  }
+  exit(0);
+}
+
+// meant to be run w/ at most two CPUs
+void
+preempt(char *s)
+{
+  int pid1, pid2, pid3;
+  int pfds[2];
+
+  pid1 = fork();
+  if(pid1 < 0) {
+    printf("%s: fork failed", s);
+    exit(1);
+  }
+  if(pid1 == 0)
+    for(;;)
+      ;
+
+  pid2 = fork();
+  if(pid2 < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid2 == 0)
+    for(;;)
+      ;
+
+  pipe(pfds);
+  pid3 = fork();
+  if(pid3 < 0) {
+     printf("%s: fork failed\n", s);
+     exit(1);
+  }
+  if(pid3 == 0){
+    close(pfds[0]);
+    if(write(pfds[1], "x", 1) != 1)
+      printf("%s: preempt write error", s);
+    close(pfds[1]);
+    for(;;)
+      ;
+  }
+
+  close(pfds[1]);
+  if(read(pfds[0], buf, sizeof(buf)) != 1){
+    printf("%s: preempt read error", s);
+    return;
+  }
+  close(pfds[0]);
+  printf("kill... ");
+  kill(pid1);
+  kill(pid2);
+  kill(pid3);
+  printf("wait... ");
+  wait(0);
+  wait(0);
+  wait(0);
+}
+
+// setprio() accepts levels 0..2 of existing processes only,
+// and a CPU-bound child at the lowest level still finishes.
+void
+setpriotest(char *s)
+{
+  int pid, xstatus;
+
+  if(setprio(getpid(), -1) >= 0 || setprio(getpid(), 3) >= 0){
+    printf("%s: setprio accepted a bad level\n", s);
+    exit(1);
+  }
+  if(setprio(1000000, 1) >= 0){
+    printf("%s: setprio accepted a bad pid\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    volatile int i;
+    for(i = 0; i < 10000000; i++)
+      ;
+    exit(0);
+  }
+  if(setprio(pid, 2) < 0){
+    printf("%s: setprio failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(setprio(getpid(), 0) < 0){
+    printf("%s: setprio of self failed\n", s);
+    exit(1);
+  }
+}
+
+// mmap() a file shared, check that pages read in lazily with
+// zeros past the end, that a forked child shares the mapping,
+// and that stores reach the file on munmap(). a store to a
+// read-only mapping kills the process.
+void
+mmaptest(char *s)
+{
+  int fd, i, j, m, pid, xstatus;
+  char *p;
+  static char buf[BSIZE];
+  int n = 2*PGSIZE + 100;
+
+  unlink("mmapf");
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i += m){
+    m = n - i < BSIZE ? n - i : BSIZE;
+    for(j = 0; j < m; j++)
+      buf[j] = 'a' + (i + j) % 26;
+    if(write(fd, buf, m) != m){
+      printf("%s: write mmapf failed\n", s);
+      exit(1);
+    }
+  }
+
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < 3*PGSIZE; i++){
+    if(p[i] != (i < n ? 'a' + i % 26 : 0)){
+      printf("%s: wrong byte %d in mapping\n", s, i);
+      exit(1);
+    }
+  }
+
+  p[0] = 'X';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[0] != 'X')
+      exit(1);
+    p[PGSIZE] = 'Y';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not share the mapping\n", s);
+    exit(1);
+  }
+  if(munmap(p, 3*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  fd = open("mmapf", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'X'){
+    printf("%s: store to mapping not written back\n", s);
+    exit(1);
+  }
+  p = mmap(0, n, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: read-only mmap failed\n", s);
+    exit(1);
+  }
+  if(mmap(0, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("%s: writable shared mmap of read-only fd\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(p[PGSIZE] != 'Y'){
+    printf("%s: child's store not written back\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    p[0] = 'Z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: store to read-only mapping succeeded\n", s);
+    exit(1);
+  }
+  if(munmap(p, n) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  unlink("mmapf");
+}
+
+// a private mapping shares the page cache's copy of a file
+// page; a read() into it must not change the file, and fails
+// if the mapping is read-only.
+void
+mmapprivtest(char *s)
+{
+  int fd, fdb, i, k, prot;
+  int prots[] = { PROT_READ, PROT_READ|PROT_WRITE };
+  char *p;
+  static char buf[PGSIZE];
+
+  unlink("mmapa");
+  unlink("mmapb");
+  memset(buf, 'a', PGSIZE);
+  fd = open("mmapa", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, PGSIZE) != PGSIZE){
+    printf("%s: create mmapa failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  memset(buf, 'b', PGSIZE);
+  fdb = open("mmapb", O_CREATE|O_RDWR);
+  if(fdb < 0 || write(fdb, buf, 100) != 100){
+    printf("%s: create mmapb failed\n", s);
+    exit(1);
+  }
+
+  for(k = 0; k < 2; k++){
+    prot = prots[k];
+    fd = open("mmapa", O_RDONLY);
+    p = mmap(0, PGSIZE, prot, MAP_PRIVATE, fd, 0);
+    if(p == (char*)-1){
+      printf("%s: mmap failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(p[0] != 'a'){
+      printf("%s: wrong byte in mapping\n", s);
+      exit(1);
+    }
+    // the read fault above mapped the page cache's page.
+    if(pread(fdb, p, 100, 0) != ((prot & PROT_WRITE) ? 100 : -1)){
+      printf("%s: read into private mapping, prot %d\n", s, prot);
+      exit(1);
+    }
+    if(p[0] != ((prot & PROT_WRITE) ? 'b' : 'a')){
+      printf("%s: wrong byte in mapping after read\n", s);
+      exit(1);
+    }
+    munmap(p, PGSIZE);
+
+    fd = open("mmapa", O_RDONLY);
+    if(read(fd, buf, PGSIZE) != PGSIZE){
+      printf("%s: read mmapa failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    for(i = 0; i < PGSIZE; i++){
+      if(buf[i] != 'a'){
+        printf("%s: read into private mapping changed the file\n", s);
+        exit(1);
+      }
+    }
+  }
+  close(fdb);
+  unlink("mmapa");
+  unlink("mmapb");
+}
+
+// a write() to a file from its own mapping, not yet faulted in,
+// must fault the page in before writei() reads the block it
+// shares with the destination.
+void
+mmapselftest(char *s)
+{
+  int fd, i;
+  char *p;
+  static char buf[PGSIZE];
+
+  unlink("mmaps");
+  memset(buf, 'a', PGSIZE/2);
+  memset(buf + PGSIZE/2, 'b', PGSIZE/2);
+  fd = open("mmaps", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, PGSIZE) != PGSIZE){
+    printf("%s: create mmaps failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, p + PGSIZE/2, 100, 0) != 100){
+    printf("%s: write from own mapping failed\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  if(pread(fd, buf, PGSIZE, 0) != PGSIZE){
+    printf("%s: read mmaps failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < PGSIZE; i++){
+    if(buf[i] != (i < 100 || i >= PGSIZE/2 ? 'b' : 'a')){
+      printf("%s: wrong byte %d after write from mapping\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("mmaps");
+}
+
+// writev() and readv() gather and scatter several buffers, and
+// pread() and pwrite() leave the file offset alone.
+void
+iovtest(char *s)
+{
+  int fd;
+  char hdr[4], body[6], buf[16];
+  struct iovec iov[2];
+
+  unlink("iovf");
+  if((fd = open("iovf", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create iovf failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "HDR:";
+  iov[0].iov_len = 4;
+  iov[1].iov_base = "body!";
+  iov[1].iov_len = 5;
+  if(writev(fd, iov, 2) != 9){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "B", 1, 4) != 1 || pread(fd, buf, 3, 3) != 3 ||
+     memcmp(buf, ":Bo", 3) != 0){
+    printf("%s: pwrite/pread failed\n", s);
+    exit(1);
+  }
+  // the offset is still at the end of the writev().
+  if(write(fd, "?", 1) != 1 || pread(fd, buf, sizeof(buf), 0) != 10 ||
+     memcmp(buf, "HDR:Body!?", 10) != 0){
+    printf("%s: pwrite/pread moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iovf", O_RDONLY);
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = body;
+  iov[1].iov_len = sizeof(body);
+  if(readv(fd, iov, 2) != 10 || memcmp(hdr, "HDR:", 4) != 0 ||
+     memcmp(body, "Body!?", 6) != 0){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, MAXIOV + 1) != -1){
+    printf("%s: readv took too many iovecs\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iovf");
+}
+
+// copy_file_range() to a file and to a pipe.
+void
+copyrange(char *s)
+{
+  int fd0, fd1, fds[2], i, n;
+  static char data[3*4096 + 100];
+
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = 'a' + i % 23;
+  unlink("crf0");
+  unlink("crf1");
+  fd0 = open("crf0", O_CREATE|O_RDWR);
+  fd1 = open("crf1", O_CREATE|O_RDWR);
+  if(fd0 < 0 || fd1 < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd0, data, sizeof(data)) != sizeof(data)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(copy_file_range(fd0, fd1, 100) != 0){
+    printf("%s: copy at end of file\n", s);
+    exit(1);
+  }
+  close(fd0);
+  fd0 = open("crf0", O_RDONLY);
+  // more than there is: a short count, not an error.
+  if(copy_file_range(fd0, fd1, sizeof(data) + 1000) != sizeof(data)){
+    printf("%s: copy_file_range to file failed\n", s);
+    exit(1);
+  }
+  close(fd1);
+  fd1 = open("crf1", O_RDONLY);
+  memset(buf, 0, sizeof(buf));
+  for(i = 0; (n = read(fd1, buf, sizeof(buf))) > 0; i += n){
+    if(i + n > sizeof(data) || memcmp(buf, data + i, n) != 0){
+      printf("%s: copied wrong data\n", s);
+      exit(1);
+    }
+  }
+  if(i != sizeof(data)){
+    printf("%s: copied %d bytes\n", s, i);
+    exit(1);
+  }
+  close(fd1);
+  if(copy_file_range(fd0, fd0, 1) != -1){
+    printf("%s: copy_file_range to a read-only file\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  close(fd0);
+  fd0 = open("crf0", O_RDONLY);
+  if(copy_file_range(fd0, fds[1], 1000) != 1000 ||
+     read(fds[0], buf, 1000) != 1000 || memcmp(buf, data, 1000) != 0){
+    printf("%s: copy_file_range to pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(fd0);
+  unlink("crf0");
+  unlink("crf1");
+}
+
+void
+fsynctest(char *s)
+{
+  int fd, i;
+
+  unlink("fsyncf");
+  if((fd = open("fsyncf", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create fsyncf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    if(write(fd, "aaaaaaaaaa", 10) != 10){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of a closed fd succeeded\n", s);
+    exit(1);
+  }
+  unlink("fsyncf");
+}
+
+// a pipe's lock should appear in lockstat() while the pipe
+// exists, and have been counted by acquire().
+void
+lockstattest(char *s)
+{
+  struct lockstat ls[64];
+  int fds[2], n0, n1, n, i;
+
+  n0 = lockstat(0, 0);
+  if(n0 <= 0){
+    printf("%s: lockstat found no locks\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if((n1 = lockstat(ls, 64)) != n0 + 1){
+    printf("%s: %d locks after pipe(), expected %d\n", s, n1, n0 + 1);
+    exit(1);
+  }
+  n = n1 < 64 ? n1 : 64;
+  for(i = 0; i < n; i++)
+    if(strcmp(ls[i].name, "pipe") == 0 && ls[i].nacquire > 0)
+      break;
+  if(i == n){
+    printf("%s: no acquired pipe lock\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(lockstat(0, 0) != n0){
+    printf("%s: pipe's lock outlived it\n", s);
+    exit(1);
+  }
+  if(lockstat((struct lockstat*)0xffffffffffffff00ULL, 64) != -1){
+    printf("%s: lockstat to a bad address succeeded\n", s);
+    exit(1);
+  }
+}
+
+// nsec() and clocktime() read the same clock, which
+// should advance steadily along with uptime().
+void
+clocktest(char *s)
+{
+  uint64 t0, t1, t2;
+  int i;
+
+  t0 = nsec();
+  t1 = clocktime();
+  t2 = nsec();
+  if(t1 < t0 || t2 < t1){
+    printf("%s: clock went backwards: %l %l %l\n", s, t0, t1, t2);
+    exit(1);
+  }
+  for(i = 0; i < 1000; i++){
+    t1 = nsec();
+    if(t1 < t2){
+      printf("%s: nsec went backwards\n", s);
+      exit(1);
+    }
+    t2 = t1;
+  }
+  t0 = nsec();
+  sleep(2);
+  t1 = nsec();
+  // at least one full tick of sleep, of about 100ms.
+  if(t1 - t0 < 50000000L || t1 - t0 > 10000000000L){
+    printf("%s: sleep(2) took %l ns\n", s, t1 - t0);
+    exit(1);
+  }
+}
+
+// wait3() and getrusage() should report what a child
+// did: run in user space, fault in pages, write blocks
+// and sleep.
+void
+rusagetest(char *s)
+{
+  struct rusage ru, cru;
+  uint64 t0;
+  char *p;
+  int fd, i, pid, xstatus;
+
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(t0 = nsec(); nsec() - t0 < 50000000L; )
+      ;
+    p = sbrk(8 * 4096);
+    for(i = 0; i < 8; i++)
+      p[i * 4096] = 1;
+    if((fd = open("rusagef", O_CREATE|O_WRONLY)) < 0)
+      exit(1);
+    write(fd, p, 4096);
+    close(fd);
+    unlink("rusagef");
+    sleep(1);
+    exit(0);
+  }
+  if(wait3(&xstatus, &ru) != pid || xstatus != 0){
+    printf("%s: wait3 failed\n", s);
+    exit(1);
+  }
+  if(ru.utime == 0 || ru.stime == 0){
+    printf("%s: no time used: %l %l\n", s, ru.utime, ru.stime);
+    exit(1);
+  }
+  if(ru.nfault < 8 || ru.oublock == 0 || ru.nvcsw == 0){
+    printf("%s: %l faults %l blocks %l sleeps\n", s, ru.nfault, ru.oublock, ru.nvcsw);
+    exit(1);
+  }
+  if(getrusage(RUSAGE_CHILDREN, &cru) != 0 ||
+     cru.utime < ru.utime || cru.nfault < ru.nfault){
+    printf("%s: getrusage(RUSAGE_CHILDREN) is missing the child\n", s);
+    exit(1);
+  }
+  if(getrusage(RUSAGE_SELF, &ru) != 0 || ru.stime == 0){
+    printf("%s: getrusage(RUSAGE_SELF) failed\n", s);
+    exit(1);
+  }
+  if(getrusage(5, &ru) != -1){
+    printf("%s: getrusage(5) succeeded\n", s);
+    exit(1);
+  }
+}
+
+#define NCLONE 4
+#define CLONEITER 10000
+
+int clonecount;
+char *clonemem[NCLONE];
+int clonefds[2];
+
+void
+clonefn(void *arg)
+{
+  int id = (uint64)arg, i;
+  char *p;
+
+  for(i = 0; i < CLONEITER; i++)
+    __sync_fetch_and_add(&clonecount, 1);
+  // sbrk() grows the memory all the threads share.
+  if((p = sbrk(4096)) == (char*)-1)
+    exit(1);
+  p[0] = 'a' + id;
+  clonemem[id] = p;
+  if(write(clonefds[1], "x", 1) != 1)
+    exit(1);
+  exit(0);
+}
+
+// threads made by clone() share memory and file descriptors.
+void
+clonetest(char *s)
+{
+  int tid[NCLONE], i, xstatus;
+  char *stack[NCLONE], c;
+
+  if(pipe(clonefds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  clonecount = 0;
+  for(i = 0; i < NCLONE; i++){
+    stack[i] = malloc(4096);
+    if((tid[i] = clone(clonefn, (void*)(uint64)i, stack[i] + 4096)) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(join(tid[i], &xstatus) != tid[i] || xstatus != 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+  }
+  if(clonecount != NCLONE * CLONEITER){
+    printf("%s: count %d, not %d\n", s, clonecount, NCLONE * CLONEITER);
+    exit(1);
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(clonemem[i] == 0 || clonemem[i][0] != 'a' + i){
+      printf("%s: thread %d's memory is missing\n", s, i);
+      exit(1);
+    }
+    if(read(clonefds[0], &c, 1) != 1){
+      printf("%s: thread %d's write is missing\n", s, i);
+      exit(1);
+    }
+    free(stack[i]);
+  }
+  close(clonefds[0]);
+  close(clonefds[1]);
+  if(join(tid[0], 0) != -1){
+    printf("%s: joined a thread twice\n", s);
+    exit(1);
+  }
+}
+
+int futexmu;
+int futexcount;
+
+void
+futexfn(void *arg)
+{
+  int i, v;
+
+  for(i = 0; i < CLONEITER; i++){
+    mutex_lock(&futexmu);
+    v = futexcount;
+    if(i % 2500 == 0)
+      sleep(1);   // hold the lock a while, so that others park
+    futexcount = v + 1;
+    mutex_unlock(&futexmu);
+  }
+  exit(0);
+}
+
+// a futex mutex keeps threads' increments apart.
 void
-killstatus(char *s)
+futextest(char *s)
 {
-  int xst;
-  
-  for(int i = 0; i < 100; i++){
-    int pid1 = fork();
-    if(pid1 < 0){
-      printf("%s: fork failed\n", s);
+  int tid[NCLONE], i, xstatus, word = 1;
+  char *stack[NCLONE];
+
+  if(futex_wait(&word, 0) != -1){
+    printf("%s: futex_wait slept on a changed value\n", s);
+    exit(1);
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf("%s: futex_wake woke a sleeper that isn't there\n", s);
+    exit(1);
+  }
+  futexmu = 0;
+  futexcount = 0;
+  for(i = 0; i < NCLONE; i++){
+    stack[i] = malloc(4096);
+    if((tid[i] = clone(futexfn, 0, stack[i] + 4096)) < 0){
+      printf("%s: clone failed\n", s);
       exit(1);
     }
-    if(pid1 == 0){
-      while(1) {
-        getpid();
-      }
-      exit(0);
-    }
-    sleep(1);
-    kill(pid1);
-    wait(&xst);
-    if(xst != -1) {
-       printf("%s: status should be -1\n", s);
-       exit(1);
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(join(tid[i], &xstatus) != tid[i] || xstatus != 0){
+      printf("%s: join failed\n", s);
+      exit(1);
     }
+    free(stack[i]);
+  }
+  if(futexcount != NCLONE * CLONEITER || futexmu != 0){
+    printf("%s: count %d, not %d\n", s, futexcount, NCLONE * CLONEITER);
+    exit(1);
   }
+}
+
+void
+futexforkfn(void *arg)
+{
+  mutex_lock(&futexmu);
+  futexcount++;
+  mutex_unlock(&futexmu);
   exit(0);
 }
 
-// meant to be run w/ at most two CPUs
+// a thread parked on a mutex is still woken after a fork() has
+// moved the mutex to a new copy-on-write page.
 void
-preempt(char *s)
+futexforktest(char *s)
 {
-  int pid1, pid2, pid3;
-  int pfds[2];
+  int tid, pid, xstatus;
+  char *stack;
 
-  pid1 = fork();
-  if(pid1 < 0) {
-    printf("%s: fork failed", s);
+  futexmu = 0;
+  futexcount = 0;
+  mutex_lock(&futexmu);
+  stack = malloc(4096);
+  if((tid = clone(futexforkfn, 0, stack + 4096)) < 0){
+    printf("%s: clone failed\n", s);
     exit(1);
   }
-  if(pid1 == 0)
-    for(;;)
-      ;
-
-  pid2 = fork();
-  if(pid2 < 0) {
+  sleep(5);   // let the thread park
+  if((pid = fork()) < 0){
     printf("%s: fork failed\n", s);
     exit(1);
   }
-  if(pid2 == 0)
-    for(;;)
-      ;
+  if(pid == 0)
+    exit(0);
+  waitpid(pid, 0, 0);
+  mutex_unlock(&futexmu);
+  if(join(tid, &xstatus) != tid || xstatus != 0){
+    printf("%s: join failed\n", s);
+    exit(1);
+  }
+  free(stack);
+  if(futexcount != 1){
+    printf("%s: count %d, not 1\n", s, futexcount);
+    exit(1);
+  }
+}
 
-  pipe(pfds);
-  pid3 = fork();
-  if(pid3 < 0) {
-     printf("%s: fork failed\n", s);
-     exit(1);
+// poll() finds the one pipe of several with data, times out,
+// and reports a closed pipe.
+void
+polltest(char *s)
+{
+  enum { NP = 3 };
+  int fds[NP][2], i, n, pid;
+  struct pollfd pfd[NP];
+  char c;
+
+  for(i = 0; i < NP; i++){
+    if(pipe(fds[i]) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pfd[i].fd = fds[i][0];
+    pfd[i].events = POLLIN;
   }
-  if(pid3 == 0){
-    close(pfds[0]);
-    if(write(pfds[1], "x", 1) != 1)
-      printf("%s: preempt write error", s);
-    close(pfds[1]);
-    for(;;)
-      ;
+  if((n = poll(pfd, NP, 0)) != 0){
+    printf("%s: poll of empty pipes returned %d\n", s, n);
+    exit(1);
+  }
+  if((n = poll(pfd, NP, 2)) != 0){
+    printf("%s: poll with a timeout returned %d\n", s, n);
+    exit(1);
   }
 
-  close(pfds[1]);
-  if(read(pfds[0], buf, sizeof(buf)) != 1){
-    printf("%s: preempt read error", s);
-    return;
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(fds[1][1], "x", 1);
+    exit(0);
+  }
+  if((n = poll(pfd, NP, -1)) != 1 || pfd[1].revents != POLLIN ||
+     pfd[0].revents != 0 || pfd[2].revents != 0){
+    printf("%s: poll returned %d, revents %d %d %d\n", s, n,
+           pfd[0].revents, pfd[1].revents, pfd[2].revents);
+    exit(1);
+  }
+  if(read(fds[1][0], &c, 1) != 1 || c != 'x'){
+    printf("%s: read after poll failed\n", s);
+    exit(1);
   }
-  close(pfds[0]);
-  printf("kill... ");
-  kill(pid1);
-  kill(pid2);
-  kill(pid3);
-  printf("wait... ");
-  wait(0);
-  wait(0);
   wait(0);
+
+  close(fds[2][1]);
+  if(poll(pfd, NP, -1) != 1 || (pfd[2].revents & POLLHUP) == 0){
+    printf("%s: no POLLHUP for a closed pipe\n", s);
+    exit(1);
+  }
+  pfd[0].fd = fds[0][1];
+  pfd[0].events = POLLOUT;
+  pfd[1].fd = 99;
+  if(poll(pfd, 2, 0) != 2 || pfd[0].revents != POLLOUT || pfd[1].revents != POLLNVAL){
+    printf("%s: poll of a writable pipe or bad fd failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NP; i++){
+    close(fds[i][0]);
+    if(i != 2)
+      close(fds[i][1]);
+  }
 }
 
 // try to find any races between exit and wait
@@ -1080,6 +1954,45 @@ mem(char *s)
   }
 }
 
+// blocks of every size class, and large ones, keep their
+// contents, and freed blocks are reused.
+void
+mallocsizes(char *s)
+{
+  enum { N = 200 };
+  char *p[N], *q;
+  int i, j, n;
+
+  for(i = 0; i < N; i++){
+    n = (i * 37) % 5000 + 1;
+    if((p[i] = malloc(n)) == 0){
+      printf("%s: malloc(%d) failed\n", s, n);
+      exit(1);
+    }
+    memset(p[i], i, n);
+  }
+  for(i = 0; i < N; i += 2)
+    free(p[i]);
+  for(i = 1; i < N; i += 2){
+    n = (i * 37) % 5000 + 1;
+    for(j = 0; j < n; j++){
+      if(p[i][j] != (char)i){
+        printf("%s: block %d of %d bytes was overwritten\n", s, i, n);
+        exit(1);
+      }
+    }
+  }
+  q = malloc(100);
+  free(q);
+  if(malloc(100) != q){
+    printf("%s: a freed block was not reused\n", s);
+    exit(1);
+  }
+  free(q);
+  for(i = 1; i < N; i += 2)
+    free(p[i]);
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -1553,6 +2466,83 @@ bigdir(char *s)
   }
 }
 
+// a directory big enough to be indexed: lookups find exactly
+// the names present, and new names reuse the slots of removed
+// ones instead of growing the directory.
+void
+dirindex(char *s)
+{
+  enum { N = 200 };
+  int i, fd;
+  char name[4];
+  struct stat st1, st2;
+
+  if(mkdir("dix") != 0 || chdir("dix") != 0){
+    printf("%s: mkdir dix failed\n", s);
+    exit(1);
+  }
+  name[0] = 'f';
+  name[3] = '\0';
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    if((fd = open(name, O_CREATE)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  if(stat(".", &st1) < 0){
+    printf("%s: stat . failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i += 2){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    fd = open(name, O_RDONLY);
+    if((fd >= 0) != (i % 2 == 1)){
+      printf("%s: open %s gave %d\n", s, name, fd);
+      exit(1);
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  for(i = 0; i < N; i += 2){
+    name[1] = 'a' + i / 64;
+    name[2] = '0' + i % 64;
+    if((fd = open(name, O_CREATE)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  if(stat(".", &st2) < 0 || st2.size != st1.size){
+    printf("%s: directory grew from %d to %d\n", s, st1.size, st2.size);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[1] = (i % 2 ? '0' : 'a') + i / 64;
+    name[2] = '0' + i % 64;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  chdir("..");
+  if(unlink("dix") != 0){
+    printf("%s: unlink dix failed\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -1865,6 +2855,100 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// write and read back an extent-mapped file whose blocks are
+// interleaved with another file's, so that it needs more than
+// NIEXTENT extents, then truncate it and reuse it.
+void
+extentfile(char *s)
+{
+  enum { N = 300 };
+  int fd, fd2, i, round;
+
+  unlink("extent.dat");
+  unlink("extent2.dat");
+  for(round = 0; round < 2; round++){
+    fd = open("extent.dat", O_CREATE | O_RDWR | O_TRUNC | O_EXTENT);
+    // a second growing file breaks up the first one's extents.
+    fd2 = open("extent2.dat", O_CREATE | O_RDWR | O_TRUNC);
+    if(fd < 0 || fd2 < 0){
+      printf("%s: cannot create extent.dat\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      memset(buf, i + round, BSIZE);
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: write extent.dat failed at block %d\n", s, i);
+        exit(1);
+      }
+      if(i % 10 == 0 && write(fd2, buf, BSIZE) != BSIZE){
+        printf("%s: write extent2.dat failed\n", s);
+        exit(1);
+      }
+    }
+    close(fd2);
+    close(fd);
+
+    fd = open("extent.dat", O_RDONLY);
+    for(i = 0; i < N; i++){
+      if(read(fd, buf, BSIZE) != BSIZE){
+        printf("%s: read extent.dat failed at block %d\n", s, i);
+        exit(1);
+      }
+      if(buf[0] != (char)(i + round) || buf[BSIZE-1] != (char)(i + round)){
+        printf("%s: extent.dat has wrong data at block %d\n", s, i);
+        exit(1);
+      }
+    }
+    if(read(fd, buf, 1) != 0){
+      printf("%s: extent.dat too long\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+  unlink("extent.dat");
+  unlink("extent2.dat");
+}
+
+// an extent-mapped file that runs out of extents gets a short
+// write, not a panic.
+void
+extentfull(char *s)
+{
+  int fd, fd2, i, r;
+  struct stat st;
+
+  unlink("extent.dat");
+  unlink("extent2.dat");
+  fd = open("extent.dat", O_CREATE | O_RDWR | O_TRUNC | O_EXTENT);
+  fd2 = open("extent2.dat", O_CREATE | O_RDWR | O_TRUNC);
+  if(fd < 0 || fd2 < 0){
+    printf("%s: cannot create extent.dat\n", s);
+    exit(1);
+  }
+  // interleaving every block needs an extent per block.
+  memset(buf, 'x', BSIZE);
+  for(i = 0; i <= NEXTENT; i++){
+    if((r = write(fd, buf, BSIZE)) != BSIZE)
+      break;
+    if(write(fd2, buf, BSIZE) != BSIZE){
+      printf("%s: write extent2.dat failed\n", s);
+      exit(1);
+    }
+  }
+  if(i > NEXTENT || r != -1){
+    printf("%s: %d blocks fit in %d extents\n", s, i, NEXTENT);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != i * BSIZE){
+    printf("%s: extent.dat has the wrong size\n", s);
+    exit(1);
+  }
+  close(fd2);
+  close(fd);
+  unlink("extent.dat");
+  unlink("extent2.dat");
+}
+
 void
 fourteen(char *s)
 {
@@ -2080,6 +3164,69 @@ forktest(char *s)
   }
 }
 
+// parent and child share pages copy-on-write after fork.
+// a store by either one must not be visible to the other,
+// whether it comes from user code or from the kernel (read()).
+void
+cowfork(char *s)
+{
+  enum { SZ = 64*4096 };
+  char *a;
+  int i, pid, xstatus, fds[2];
+
+  a = sbrk(SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i += 4096)
+    a[i] = i / 4096;
+  a[SZ-1] = 'p';
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < SZ; i += 4096){
+      if(a[i] != (char)(i / 4096))
+        exit(1);
+      if(i < SZ - 4096)
+        a[i] = 'c';
+    }
+    // copyout() into the last page, which is still shared.
+    if(a[SZ-1] != 'p')
+      exit(1);
+    if(write(fds[1], "k", 1) != 1 || read(fds[0], a + SZ - 1, 1) != 1)
+      exit(1);
+    if(a[SZ-1] != 'k')
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i += 4096){
+    if(a[i] != (char)(i / 4096)){
+      printf("%s: child's store leaked into parent\n", s);
+      exit(1);
+    }
+  }
+  if(a[SZ-1] != 'p'){
+    printf("%s: child's read() leaked into parent\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2304,16 +3451,14 @@ sbrkfail(char *s)
   if(pid == 0){
     // allocate a lot of memory.
     // this should produce a page fault,
-    // and thus not complete.
+    // and thus not complete. loads alone would not,
+    // since they all map the same page of zeros.
     a = sbrk(0);
     sbrk(10*BIG);
-    int n = 0;
     for (i = 0; i < 10*BIG; i += PGSIZE) {
-      n += *(a+i);
+      *(a+i) = 1;
     }
-    // print n so the compiler doesn't optimize away
-    // the for loop.
-    printf("%s: allocate a lot of memory succeeded %d\n", s, n);
+    printf("%s: allocate a lot of memory succeeded\n", s);
     exit(1);
   }
   wait(&xstatus);
@@ -2321,6 +3466,53 @@ sbrkfail(char *s)
     exit(1);
 }
 
+// loads from memory that was never stored to all map one page
+// of zeros, so a process can read more memory than the machine
+// has. stores, and copyout() into such memory, still get pages
+// of their own.
+void
+zeropage(char *s)
+{
+  enum { BIG=128*1024*1024 };   // all of physical memory
+  char *a;
+  int i, n, fds[2];
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  for(i = 0; i < BIG; i += PGSIZE)
+    n += a[i];
+  if(n != 0){
+    printf("%s: fresh memory is not zero\n", s);
+    exit(1);
+  }
+
+  a[PGSIZE] = 1;
+  if(a[0] != 0 || a[PGSIZE] != 1 || a[2*PGSIZE] != 0){
+    printf("%s: store reached other pages\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], a+PGSIZE, 1) != 1 || read(fds[0], a+3*PGSIZE, 1) != 1){
+    printf("%s: pipe write or read failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(a[3*PGSIZE] != 1 || a[4*PGSIZE] != 0 || a[0] != 0){
+    printf("%s: read() into zero page went wrong\n", s);
+    exit(1);
+  }
+  sbrk(-BIG);
+}
+
   
 // test reads/writes from/to allocated memory
 void
@@ -2850,6 +4042,8 @@ main(int argc, char *argv[])
     {sharedfd, "sharedfd"},
     {dirtest, "dirtest"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
+    {waitpidtest, "waitpidtest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2857,6 +4051,7 @@ main(int argc, char *argv[])
     {sbrkmuch, "sbrkmuch"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
+    {zeropage, "zeropage"},
     {sbrkarg, "sbrkarg"},
     {sbrklast, "sbrklast"},
     {sbrk8000, "sbrk8000"},
@@ -2870,17 +4065,36 @@ main(int argc, char *argv[])
     {exitiputtest, "exitiput"},
     {iputtest, "iput"},
     {mem, "mem"},
+    {mallocsizes, "mallocsizes"},
     {pipe1, "pipe1"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
+    {setpriotest, "setprio"},
+    {mmaptest, "mmap"},
+    {mmapprivtest, "mmappriv"},
+    {mmapselftest, "mmapself"},
+    {iovtest, "iov"},
+    {copyrange, "copyrange"},
+    {fsynctest, "fsync"},
+    {lockstattest, "lockstat"},
+    {clocktest, "clock"},
+    {rusagetest, "rusage"},
+    {clonetest, "clone"},
+    {futextest, "futex"},
+    {futexforktest, "futexfork"},
+    {polltest, "poll"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
     {fourteen, "fourteen"},
     {bigfile, "bigfile"},
+    {extentfile, "extentfile"},
+    {extentfull, "extentfull"},
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {cowfork, "cowfork"},
     {bigdir, "bigdir"}, // slow
+    {dirindex, "dirindex"},
     { 0, 0},
   };
 
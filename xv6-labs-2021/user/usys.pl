@@ -36,3 +36,25 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("setprio");
+entry("mmap");
+entry("munmap");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("copy_file_range");
+entry("fsync");
+entry("lockstat");
+entry("sysstat");
+entry("iostat");
+entry("clocktime");
+entry("wait3");
+entry("getrusage");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("poll");
+entry("spawn");
+entry("waitpid");